@@ -107,4 +107,30 @@ Quat4f operator * ( const Quat4f& q0, const Quat4f& q1 );
 Quat4f operator * ( float f, const Quat4f& q );
 Quat4f operator * ( const Quat4f& q, float f );
 
+// static
+inline Matrix3f Matrix3f::rotation( const Quat4f& rq )
+{
+	Quat4f q = rq.normalized();
+
+	float xx = q.x() * q.x();
+	float yy = q.y() * q.y();
+	float zz = q.z() * q.z();
+
+	float xy = q.x() * q.y();
+	float zw = q.z() * q.w();
+
+	float xz = q.x() * q.z();
+	float yw = q.y() * q.w();
+
+	float yz = q.y() * q.z();
+	float xw = q.x() * q.w();
+
+	return Matrix3f
+		(
+			1.0f - 2.0f * ( yy + zz ),		2.0f * ( xy - zw ),				2.0f * ( xz + yw ),
+			2.0f * ( xy + zw ),				1.0f - 2.0f * ( xx + zz ),		2.0f * ( yz - xw ),
+			2.0f * ( xz - yw ),				2.0f * ( yz + xw ),				1.0f - 2.0f * ( xx + yy )
+		);
+}
+
 #endif // QUAT4F_H
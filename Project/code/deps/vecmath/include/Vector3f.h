@@ -1,7 +1,17 @@
 #ifndef VECTOR_3F_H
 #define VECTOR_3F_H
 
-class Vector2f;
+#include <cmath>
+#include <cstdio>
+
+#include "Vector2f.h"
+
+// Everything is defined inline here so that the vector math compiles into the callers.
+// With VECMATH_SSE (cmake -DVECMATH_SSE=ON) the elements are kept in a 4-wide SSE register,
+// the fourth lane is padding. The results are the same as the scalar version.
+#ifdef VECMATH_SSE
+#include <xmmintrin.h>
+#endif
 
 class Vector3f
 {
@@ -12,62 +22,94 @@ public:
 	static const Vector3f RIGHT;
 	static const Vector3f FORWARD;
 
-    Vector3f( float f = 0.f );
-    Vector3f( float x, float y, float z );
+#ifdef VECMATH_SSE
+    constexpr Vector3f( float f = 0.f ) : m_elements{ f, f, f, 0.f } {}
+    constexpr Vector3f( float x, float y, float z ) : m_elements{ x, y, z, 0.f } {}
+    explicit Vector3f( __m128 v ) : m_simd( v ) {}
+#else
+    constexpr Vector3f( float f = 0.f ) : m_elements{ f, f, f } {}
+    constexpr Vector3f( float x, float y, float z ) : m_elements{ x, y, z } {}
+#endif
 
-	Vector3f( const Vector2f& xy, float z );
-	Vector3f( float x, const Vector2f& yz );
+	Vector3f( const Vector2f& xy, float z ) : Vector3f( xy.x(), xy.y(), z ) {}
+	Vector3f( float x, const Vector2f& yz ) : Vector3f( x, yz.x(), yz.y() ) {}
 
-	// copy constructors
-    Vector3f( const Vector3f& rv );
+	// copy constructors, trivial so vectors are passed and copied as plain data
+    Vector3f( const Vector3f& rv ) = default;
 
 	// assignment operators
-    Vector3f& operator = ( const Vector3f& rv );
+    Vector3f& operator = ( const Vector3f& rv ) = default;
 
 	// no destructor necessary
 
 	// returns the ith element
-    const float& operator [] ( int i ) const;
-    float& operator [] ( int i );
+    const float& operator [] ( int i ) const { return m_elements[ i ]; }
+    float& operator [] ( int i ) { return m_elements[ i ]; }
+
+    float& x() { return m_elements[ 0 ]; }
+	float& y() { return m_elements[ 1 ]; }
+	float& z() { return m_elements[ 2 ]; }
 
-    float& x();
-	float& y();
-	float& z();
+	constexpr float x() const { return m_elements[ 0 ]; }
+	constexpr float y() const { return m_elements[ 1 ]; }
+	constexpr float z() const { return m_elements[ 2 ]; }
 
-	float x() const;
-	float y() const;
-	float z() const;
+	Vector2f xy() const { return Vector2f( m_elements[ 0 ], m_elements[ 1 ] ); }
+	Vector2f xz() const { return Vector2f( m_elements[ 0 ], m_elements[ 2 ] ); }
+	Vector2f yz() const { return Vector2f( m_elements[ 1 ], m_elements[ 2 ] ); }
 
-	Vector2f xy() const;
-	Vector2f xz() const;
-	Vector2f yz() const;
+	Vector3f xyz() const { return *this; }
+	Vector3f yzx() const { return Vector3f( m_elements[ 1 ], m_elements[ 2 ], m_elements[ 0 ] ); }
+	Vector3f zxy() const { return Vector3f( m_elements[ 2 ], m_elements[ 0 ], m_elements[ 1 ] ); }
 
-	Vector3f xyz() const;
-	Vector3f yzx() const;
-	Vector3f zxy() const;
+	float length() const { return sqrt( squaredLength() ); }
+    float squaredLength() const { return dot( *this, *this ); }
 
-	float length() const;
-    float squaredLength() const;
+	void normalize()
+	{
+		float norm = length();
+		m_elements[ 0 ] /= norm;
+		m_elements[ 1 ] /= norm;
+		m_elements[ 2 ] /= norm;
+	}
 
-	void normalize();
-	Vector3f normalized() const;
+	Vector3f normalized() const
+	{
+		float norm = length();
+		return Vector3f( m_elements[ 0 ] / norm, m_elements[ 1 ] / norm, m_elements[ 2 ] / norm );
+	}
 
-	Vector2f homogenized() const;
+	Vector2f homogenized() const
+	{
+		return Vector2f( m_elements[ 0 ] / m_elements[ 2 ], m_elements[ 1 ] / m_elements[ 2 ] );
+	}
 
-	void negate();
+	void negate()
+	{
+		m_elements[ 0 ] = -m_elements[ 0 ];
+		m_elements[ 1 ] = -m_elements[ 1 ];
+		m_elements[ 2 ] = -m_elements[ 2 ];
+	}
 
 	// ---- Utility ----
-    operator const float* () const; // automatic type conversion for OpenGL
-    operator float* (); // automatic type conversion for OpenGL 
-	void print() const;	
+    operator const float* () const { return m_elements; } // automatic type conversion for OpenGL
+    operator float* () { return m_elements; } // automatic type conversion for OpenGL
+	void print() const
+	{
+		printf( "< %.4f, %.4f, %.4f >\n", m_elements[ 0 ], m_elements[ 1 ], m_elements[ 2 ] );
+	}
 
 	Vector3f& operator += ( const Vector3f& v );
 	Vector3f& operator -= ( const Vector3f& v );
     Vector3f& operator *= ( float f );
 
-    static float dot( const Vector3f& v0, const Vector3f& v1 );
+    static float dot( const Vector3f& v0, const Vector3f& v1 )
+    {
+        return v0[ 0 ] * v1[ 0 ] + v0[ 1 ] * v1[ 1 ] + v0[ 2 ] * v1[ 2 ];
+    }
+
 	static Vector3f cross( const Vector3f& v0, const Vector3f& v1 );
-    
+
     // computes the linear interpolation between v0 and v1 by alpha \in [0,1]
 	// returns v0 * ( 1 - alpha ) * v1 * alpha
 	static Vector3f lerp( const Vector3f& v0, const Vector3f& v1, float alpha );
@@ -77,27 +119,154 @@ public:
     // at p1, the result is p2.
 	static Vector3f cubicInterpolate( const Vector3f& p0, const Vector3f& p1, const Vector3f& p2, const Vector3f& p3, float t );
 
+#ifdef VECMATH_SSE
+	__m128 simd() const { return m_simd; }
+#endif
+
 private:
 
+#ifdef VECMATH_SSE
+	union
+	{
+		__m128 m_simd;
+		float m_elements[ 4 ];
+	};
+#else
 	float m_elements[ 3 ];
+#endif
 
 };
 
-// component-wise operators
-Vector3f operator + ( const Vector3f& v0, const Vector3f& v1 );
-Vector3f operator - ( const Vector3f& v0, const Vector3f& v1 );
-Vector3f operator * ( const Vector3f& v0, const Vector3f& v1 );
-Vector3f operator / ( const Vector3f& v0, const Vector3f& v1 );
+// component-wise operators, unary negation, multiply and divide by scalar
+
+#ifdef VECMATH_SSE
+
+inline Vector3f operator + ( const Vector3f& v0, const Vector3f& v1 ) { return Vector3f( _mm_add_ps( v0.simd(), v1.simd() ) ); }
+inline Vector3f operator - ( const Vector3f& v0, const Vector3f& v1 ) { return Vector3f( _mm_sub_ps( v0.simd(), v1.simd() ) ); }
+inline Vector3f operator * ( const Vector3f& v0, const Vector3f& v1 ) { return Vector3f( _mm_mul_ps( v0.simd(), v1.simd() ) ); }
+inline Vector3f operator / ( const Vector3f& v0, const Vector3f& v1 ) { return Vector3f( v0[ 0 ] / v1[ 0 ], v0[ 1 ] / v1[ 1 ], v0[ 2 ] / v1[ 2 ] ); }
+
+// flip the sign bits, 0 - v would turn -0 into +0
+inline Vector3f operator - ( const Vector3f& v ) { return Vector3f( _mm_xor_ps( v.simd(), _mm_set1_ps( -0.f ) ) ); }
+
+inline Vector3f operator * ( float f, const Vector3f& v ) { return Vector3f( _mm_mul_ps( v.simd(), _mm_set1_ps( f ) ) ); }
+inline Vector3f operator * ( const Vector3f& v, float f ) { return Vector3f( _mm_mul_ps( v.simd(), _mm_set1_ps( f ) ) ); }
+inline Vector3f operator / ( const Vector3f& v, float f ) { return Vector3f( _mm_div_ps( v.simd(), _mm_set1_ps( f ) ) ); }
+
+// static
+inline Vector3f Vector3f::cross( const Vector3f& v0, const Vector3f& v1 )
+{
+	// ( y0 z1 - z0 y1, z0 x1 - x0 z1, x0 y1 - y0 x1 ) with the lanes rotated to yzx and zxy
+	__m128 a_yzx = _mm_shuffle_ps( v0.m_simd, v0.m_simd, _MM_SHUFFLE( 3, 0, 2, 1 ) );
+	__m128 a_zxy = _mm_shuffle_ps( v0.m_simd, v0.m_simd, _MM_SHUFFLE( 3, 1, 0, 2 ) );
+	__m128 b_yzx = _mm_shuffle_ps( v1.m_simd, v1.m_simd, _MM_SHUFFLE( 3, 0, 2, 1 ) );
+	__m128 b_zxy = _mm_shuffle_ps( v1.m_simd, v1.m_simd, _MM_SHUFFLE( 3, 1, 0, 2 ) );
+	return Vector3f( _mm_sub_ps( _mm_mul_ps( a_yzx, b_zxy ), _mm_mul_ps( a_zxy, b_yzx ) ) );
+}
+
+inline Vector3f& Vector3f::operator += ( const Vector3f& v )
+{
+	m_simd = _mm_add_ps( m_simd, v.m_simd );
+	return *this;
+}
+
+inline Vector3f& Vector3f::operator -= ( const Vector3f& v )
+{
+	m_simd = _mm_sub_ps( m_simd, v.m_simd );
+	return *this;
+}
+
+inline Vector3f& Vector3f::operator *= ( float f )
+{
+	m_simd = _mm_mul_ps( m_simd, _mm_set1_ps( f ) );
+	return *this;
+}
+
+#else
+
+inline Vector3f operator + ( const Vector3f& v0, const Vector3f& v1 ) { return Vector3f( v0[ 0 ] + v1[ 0 ], v0[ 1 ] + v1[ 1 ], v0[ 2 ] + v1[ 2 ] ); }
+inline Vector3f operator - ( const Vector3f& v0, const Vector3f& v1 ) { return Vector3f( v0[ 0 ] - v1[ 0 ], v0[ 1 ] - v1[ 1 ], v0[ 2 ] - v1[ 2 ] ); }
+inline Vector3f operator * ( const Vector3f& v0, const Vector3f& v1 ) { return Vector3f( v0[ 0 ] * v1[ 0 ], v0[ 1 ] * v1[ 1 ], v0[ 2 ] * v1[ 2 ] ); }
+inline Vector3f operator / ( const Vector3f& v0, const Vector3f& v1 ) { return Vector3f( v0[ 0 ] / v1[ 0 ], v0[ 1 ] / v1[ 1 ], v0[ 2 ] / v1[ 2 ] ); }
 
-// unary negation
-Vector3f operator - ( const Vector3f& v );
+inline Vector3f operator - ( const Vector3f& v ) { return Vector3f( -v[ 0 ], -v[ 1 ], -v[ 2 ] ); }
 
-// multiply and divide by scalar
-Vector3f operator * ( float f, const Vector3f& v );
-Vector3f operator * ( const Vector3f& v, float f );
-Vector3f operator / ( const Vector3f& v, float f );
+inline Vector3f operator * ( float f, const Vector3f& v ) { return Vector3f( v[ 0 ] * f, v[ 1 ] * f, v[ 2 ] * f ); }
+inline Vector3f operator * ( const Vector3f& v, float f ) { return Vector3f( v[ 0 ] * f, v[ 1 ] * f, v[ 2 ] * f ); }
+inline Vector3f operator / ( const Vector3f& v, float f ) { return Vector3f( v[ 0 ] / f, v[ 1 ] / f, v[ 2 ] / f ); }
 
-bool operator == ( const Vector3f& v0, const Vector3f& v1 );
-bool operator != ( const Vector3f& v0, const Vector3f& v1 );
+// static
+inline Vector3f Vector3f::cross( const Vector3f& v0, const Vector3f& v1 )
+{
+    return Vector3f
+        (
+            v0.y() * v1.z() - v0.z() * v1.y(),
+            v0.z() * v1.x() - v0.x() * v1.z(),
+            v0.x() * v1.y() - v0.y() * v1.x()
+        );
+}
+
+inline Vector3f& Vector3f::operator += ( const Vector3f& v )
+{
+	m_elements[ 0 ] += v.m_elements[ 0 ];
+	m_elements[ 1 ] += v.m_elements[ 1 ];
+	m_elements[ 2 ] += v.m_elements[ 2 ];
+	return *this;
+}
+
+inline Vector3f& Vector3f::operator -= ( const Vector3f& v )
+{
+	m_elements[ 0 ] -= v.m_elements[ 0 ];
+	m_elements[ 1 ] -= v.m_elements[ 1 ];
+	m_elements[ 2 ] -= v.m_elements[ 2 ];
+	return *this;
+}
+
+inline Vector3f& Vector3f::operator *= ( float f )
+{
+	m_elements[ 0 ] *= f;
+	m_elements[ 1 ] *= f;
+	m_elements[ 2 ] *= f;
+	return *this;
+}
+
+#endif // VECMATH_SSE
+
+// static
+inline Vector3f Vector3f::lerp( const Vector3f& v0, const Vector3f& v1, float alpha )
+{
+	return alpha * ( v1 - v0 ) + v0;
+}
+
+// static
+inline Vector3f Vector3f::cubicInterpolate( const Vector3f& p0, const Vector3f& p1, const Vector3f& p2, const Vector3f& p3, float t )
+{
+	// geometric construction:
+	//            t
+	//   (t+1)/2     t/2
+	// t+1        t	        t-1
+
+	// bottom level
+	Vector3f p0p1 = Vector3f::lerp( p0, p1, t + 1 );
+	Vector3f p1p2 = Vector3f::lerp( p1, p2, t );
+	Vector3f p2p3 = Vector3f::lerp( p2, p3, t - 1 );
+
+	// middle level
+	Vector3f p0p1_p1p2 = Vector3f::lerp( p0p1, p1p2, 0.5f * ( t + 1 ) );
+	Vector3f p1p2_p2p3 = Vector3f::lerp( p1p2, p2p3, 0.5f * t );
+
+	// top level
+	return Vector3f::lerp( p0p1_p1p2, p1p2_p2p3, t );
+}
+
+inline bool operator == ( const Vector3f& v0, const Vector3f& v1 )
+{
+    return( v0.x() == v1.x() && v0.y() == v1.y() && v0.z() == v1.z() );
+}
+
+inline bool operator != ( const Vector3f& v0, const Vector3f& v1 )
+{
+    return !( v0 == v1 );
+}
 
 #endif // VECTOR_3F_H
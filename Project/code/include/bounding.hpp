@@ -16,46 +16,37 @@ public:
     Vector3f min;
     Vector3f max;
 
-    // intersect slab
-    bool intersect(const Ray &r, float &t) const {
-        Vector3f origin(r.getOrigin());
-        Vector3f invdir(1 / r.getDirection().x(), 1 / r.getDirection().y(), 1 / r.getDirection().z());
-        std::vector<bool> sign(3);
-
-        sign[0] = (invdir.x() < 0);
-        sign[1] = (invdir.y() < 0);
-        sign[2] = (invdir.z() < 0);
-        float t_min = ((sign[0] ? max.x() : min.x()) - origin.x()) * invdir.x();
-        float t_max = ((sign[0] ? min.x() : max.x()) - origin.x()) * invdir.x();
-
-        float ty_min = ((sign[1] ? max.y() : min.y()) - origin.y()) * invdir.y();
-        float ty_max = ((sign[1] ? min.y() : max.y()) - origin.y()) * invdir.y();
-
-        if ((t_min > ty_max) || (ty_min > t_max))
-            return false;
-        if (ty_min > t_min)
-            t_min = ty_min;
-        if (ty_max < t_max)
-            t_max = ty_max;
-        
-        float tz_min = ((sign[2] ? max.z() : min.z()) - origin.z()) * invdir.z();
-        float tz_max = ((sign[2] ? min.z() : max.z()) - origin.z()) * invdir.z();
-
-        if ((t_min > tz_max) || (tz_min > t_max))
-            return false;
-        if (tz_min > t_min)
-            t_min = tz_min;
-        if (tz_max < t_max)
-            t_max = tz_max;
-
-        // if (t_min < t) {
-        //     t = t_min;
-        // } else if (t_max < t) {
-        //     t = t_max;
-        // }
-        t = t_min;
+    // intersect slab, without any allocation, using the inverse direction and signs kept in the ray.
+    // if the ray overlaps the box within [tmin, tmax], t_enter and t_exit are the overlap
+    bool intersect(const Ray &r, float tmin, float tmax, float &t_enter, float &t_exit) const {
+        const Vector3f &origin = r.getOrigin();
+        const Vector3f &invdir = r.getInvDirection();
+
+        float t_min = ((r.sign[0] ? max.x() : min.x()) - origin.x()) * invdir.x();
+        float t_max = ((r.sign[0] ? min.x() : max.x()) - origin.x()) * invdir.x();
+        float ty_min = ((r.sign[1] ? max.y() : min.y()) - origin.y()) * invdir.y();
+        float ty_max = ((r.sign[1] ? min.y() : max.y()) - origin.y()) * invdir.y();
+        float tz_min = ((r.sign[2] ? max.z() : min.z()) - origin.z()) * invdir.z();
+        float tz_max = ((r.sign[2] ? min.z() : max.z()) - origin.z()) * invdir.z();
+
+        // written so that a NaN (ray in the plane of a slab) leaves the bound unchanged
+        if (t_min > tmin) tmin = t_min;
+        if (ty_min > tmin) tmin = ty_min;
+        if (tz_min > tmin) tmin = tz_min;
+        if (t_max < tmax) tmax = t_max;
+        if (ty_max < tmax) tmax = ty_max;
+        if (tz_max < tmax) tmax = tz_max;
+        if (tmin > tmax) return false;
+
+        t_enter = tmin;
+        t_exit = tmax;
         return true;
-    } 
+    }
+
+    bool intersect(const Ray &r, float tmin, float tmax, float &t) const {
+        float t_exit;
+        return intersect(r, tmin, tmax, t, t_exit);
+    }
 
     static AABB surrounding_box(AABB box0, AABB box1) {
         Vector3f small(fmin(box0.min.x(), box1.min.x()),
@@ -67,6 +58,36 @@ public:
         return AABB(small, big);
     }
 
+    // surface area, used by the SAH cost of the bvh builder
+    float surface_area() const {
+        Vector3f d = max - min;
+        if (d.x() < 0 || d.y() < 0 || d.z() < 0) return 0;
+        return 2 * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+    }
+
+    Vector3f centroid() const {
+        return 0.5f * (min + max);
+    }
+
+    // an inverted box, grows to the first box merged in
+    static AABB empty() {
+        return AABB(Vector3f(FLT_MAX, FLT_MAX, FLT_MAX), Vector3f(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+    }
+
+    void expand(const AABB &other) {
+        for (int i = 0; i < 3; i++) {
+            min[i] = fmin(min[i], other.min[i]);
+            max[i] = fmax(max[i], other.max[i]);
+        }
+    }
+
+    void expand(const Vector3f &p) {
+        for (int i = 0; i < 3; i++) {
+            min[i] = fmin(min[i], p[i]);
+            max[i] = fmax(max[i], p[i]);
+        }
+    }
+
     bool inside(Vector3f p) const {
         return p.x() >= min.x() && p.x() <= max.x() &&
             p.y() >= min.y() && p.y() <= max.y() &&
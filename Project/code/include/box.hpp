@@ -2,9 +2,11 @@
 
 #include <vector>
 #include <string>
+#include <float.h>
 
 #include "bounding.hpp"
 #include "object3d.hpp"
+#include "sampling.hpp"
 
 class Box: public Object3D {
 public:
@@ -26,35 +28,9 @@ public:
 
     bool intersect(const Ray &r, Hit &h, float tmin) override {
         // get the intersection point
-        Vector3f origin(r.getOrigin());
-        Vector3f invdir(1 / r.getDirection().x(), 1 / r.getDirection().y(), 1 / r.getDirection().z());
-        std::vector<bool> sign(3);
-
-        sign[0] = (invdir.x() < 0);
-        sign[1] = (invdir.y() < 0);
-        sign[2] = (invdir.z() < 0);
-        float t_min = ((sign[0] ? pmax.x() : pmin.x()) - origin.x()) * invdir.x();
-        float t_max = ((sign[0] ? pmin.x() : pmax.x()) - origin.x()) * invdir.x();
-
-        float ty_min = ((sign[1] ? pmax.y() : pmin.y()) - origin.y()) * invdir.y();
-        float ty_max = ((sign[1] ? pmin.y() : pmax.y()) - origin.y()) * invdir.y();
-
-        if ((t_min > ty_max) || (ty_min > t_max))
+        float t_min, t_max;
+        if (!bounding->intersect(r, -FLT_MAX, FLT_MAX, t_min, t_max))
             return false;
-        if (ty_min > t_min)
-            t_min = ty_min;
-        if (ty_max < t_max)
-            t_max = ty_max;
-
-        float tz_min = ((sign[2] ? pmax.z() : pmin.z()) - origin.z()) * invdir.z();
-        float tz_max = ((sign[2] ? pmin.z() : pmax.z()) - origin.z()) * invdir.z();
-
-        if ((t_min > tz_max) || (tz_min > t_max))
-            return false;
-        if (tz_min > t_min)
-            t_min = tz_min;
-        if (tz_max < t_max)
-            t_max = tz_max;
 
         // t_min -> t_max is the range of intersection
         // get the one larger than tmin
@@ -121,17 +97,62 @@ public:
                 // printf(/"go in\n");
             // }
             h.set(t0, material, normal);
+            h.object = this;
             return true;
         }
         return false;
     }
 
+    // the slab test alone, the face and normal are not needed
+    bool occluded(const Ray &r, float tmin, float tmax) override {
+        float t_min, t_max;
+        if (!bounding->intersect(r, -FLT_MAX, FLT_MAX, t_min, t_max))
+            return false;
+        float t0 = t_min < tmin ? t_max : t_min;
+        return t0 >= tmin && t0 < tmax;
+    }
+
     bool bounding_box(double t0, double t1, AABB &box) override {
         box = *bounding;
         return true;
     }
 
     bool finite() override { return true; }
+
+    // uniform over the area of the six faces, the back faces are hidden by the front ones
+    // so their samples end up in shadow
+    bool sampleLight(const Vector3f &p, const Vector2f &u, Vector3f &dir, float &dist, float &pdf) override {
+        Vector3f size = pmax - pmin;
+        // area of one face orthogonal to each axis
+        float face[3] = {size.y() * size.z(), size.z() * size.x(), size.x() * size.y()};
+        float total = face[0] + face[1] + face[2];
+        if (total <= 0) return false;
+        // u.x picks the face, then what is left of it the side and the first coordinate
+        float pick = u.x() * total;
+        int axis = pick < face[0] ? 0 : (pick < face[0] + face[1] ? 1 : 2);
+        int a1 = (axis + 1) % 3, a2 = (axis + 2) % 3;
+        float start = axis == 0 ? 0 : (axis == 1 ? face[0] : face[0] + face[1]);
+        float rest = fmin((pick - start) / face[axis] * 2, 1.99999988f);
+        Vector3f q;
+        q[axis] = rest < 1 ? pmin[axis] : pmax[axis];
+        q[a1] = pmin[a1] + (rest < 1 ? rest : rest - 1) * size[a1];
+        q[a2] = pmin[a2] + u.y() * size[a2];
+        Vector3f pq = q - p;
+        dist = pq.length();
+        if (dist < 1e-6) return false;
+        dir = pq / dist;
+        pdf = area_to_solid_angle(1 / (2 * total), dist, dir[axis]);
+        return pdf > 0;
+    }
+
+    float lightPdf(const Ray &r, float &t) override {
+        Hit hit;
+        if (!intersect(r, hit, 1e-3)) return 0;
+        t = hit.getT();
+        Vector3f size = pmax - pmin;
+        float total = size.y() * size.z() + size.z() * size.x() + size.x() * size.y();
+        return area_to_solid_angle(1 / (2 * total), t, Vector3f::dot(hit.getNormal(), r.getDirection()));
+    }
     
     Vector3f pmin, pmax;
     AABB* bounding;
@@ -4,86 +4,620 @@
 #include <string>
 #include <float.h>
 #include <algorithm>
+#include <utility>
 
 #include "ray.hpp"
-#include "group.hpp"
 #include "object3d.hpp"
-#include "rand.hpp"
 
-class BVHNode : public Object3D {
+// settings of the bvh builder, can be set in the scene file, see SceneParser::parseBVH
+struct BVHConfig {
+    enum Split {
+        SAH,        // binned surface area heuristic
+        MEDIAN      // object median on the longest axis
+    };
+
+    Split split = SAH;
+    int leaf_size = 4;              // max number of objects in a leaf
+    int bins = 16;                  // number of bins along each axis for SAH
+    float traversal_cost = 1.0f;    // cost of testing a node box
+    float intersect_cost = 1.0f;    // cost of intersecting an object
+    int width = 4;                  // children per node of the traversal tree, 4 or 2 for the binary tree
+};
+
+// traversal stacks are this deep, the builder keeps the trees shallower than this
+constexpr int BVH_STACK_SIZE = 64;
+// below this depth, splits fall back to the median so the depth stays bounded
+constexpr int BVH_SAH_DEPTH = 40;
+
+// a primitive as seen by the builder, index points into the caller's own array
+struct BVHPrimitive {
+    AABB box;
+    Vector3f centroid;
+    int index;
+};
+
+namespace bvh_detail {
+
+struct Bin {
+    AABB box = AABB::empty();
+    int count = 0;
+};
+
+inline int bin_index(float c, float lo, float scale, int bins) {
+    int b = int((c - lo) * scale);
+    return b < 0 ? 0 : (b >= bins ? bins - 1 : b);
+}
+
+// object median, stable so the tree does not depend on the sort implementation
+inline int split_median(std::vector<BVHPrimitive> &prims, int start, int end, int axis) {
+    std::stable_sort(prims.begin() + start, prims.begin() + end, [axis](const BVHPrimitive &a, const BVHPrimitive &b) {
+        return a.centroid[axis] < b.centroid[axis];
+    });
+    return start + (end - start) / 2;
+}
+
+// try the planes between the bins on all the axes, return the lowest cost
+inline float find_sah_split(const std::vector<BVHPrimitive> &prims, int start, int end, const AABB &box,
+                            const AABB &centroid_box, const BVHConfig &config, int &best_axis, int &best_bin) {
+    float best_cost = FLT_MAX;
+    best_axis = 0;
+    best_bin = 0;
+    float area = box.surface_area();
+    if (area <= 0) area = 1;   // flat node, only the relative cost matters
+    std::vector<Bin> bins(config.bins);
+    std::vector<float> right_area(config.bins);
+    std::vector<int> right_count(config.bins);
+
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = centroid_box.min[axis];
+        float extent = centroid_box.max[axis] - lo;
+        if (extent <= 0) continue;
+        float scale = config.bins / extent;
+
+        for (auto &bin : bins) bin = Bin();
+        for (int i = start; i < end; i++) {
+            Bin &bin = bins[bin_index(prims[i].centroid[axis], lo, scale, config.bins)];
+            bin.box.expand(prims[i].box);
+            bin.count++;
+        }
+
+        // sweep from the right to get the area and count on the right of each plane
+        AABB acc = AABB::empty();
+        int count = 0;
+        for (int b = config.bins - 1; b > 0; b--) {
+            acc.expand(bins[b].box);
+            count += bins[b].count;
+            right_area[b] = acc.surface_area();
+            right_count[b] = count;
+        }
+
+        // sweep from the left, plane after bin b
+        acc = AABB::empty();
+        count = 0;
+        for (int b = 0; b < config.bins - 1; b++) {
+            acc.expand(bins[b].box);
+            count += bins[b].count;
+            if (count == 0 || right_count[b + 1] == 0) continue;
+            float cost = config.traversal_cost + config.intersect_cost *
+                (acc.surface_area() * count + right_area[b + 1] * right_count[b + 1]) / area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+    return best_cost;
+}
+
+} // namespace bvh_detail
+
+// reorder prims[start, end) into two parts and return where the right part begins,
+// or -1 if they should stay together in a leaf. box bounds all the prims, depth is the depth of the node.
+inline int bvh_split(std::vector<BVHPrimitive> &prims, int start, int end, const AABB &box, const BVHConfig &config,
+                     int depth) {
+    using namespace bvh_detail;
+    int n = end - start;
+    if (n <= 1) return -1;
+
+    AABB centroid_box = AABB::empty();
+    for (int i = start; i < end; i++) {
+        centroid_box.expand(prims[i].centroid);
+    }
+
+    // split on the longest axis of the centroids
+    Vector3f extent = centroid_box.max - centroid_box.min;
+    int axis = 0;
+    if (extent.y() > extent[axis]) axis = 1;
+    if (extent.z() > extent[axis]) axis = 2;
+    if (extent[axis] <= 0) {
+        // all the centroids are at the same place, no plane can separate them
+        return n <= config.leaf_size ? -1 : split_median(prims, start, end, axis);
+    }
+
+    if (config.split == BVHConfig::MEDIAN || depth >= BVH_SAH_DEPTH) {
+        return n <= config.leaf_size ? -1 : split_median(prims, start, end, axis);
+    }
+
+    int split_axis, split_bin;
+    float cost = find_sah_split(prims, start, end, box, centroid_box, config, split_axis, split_bin);
+    if (n <= config.leaf_size && cost >= config.intersect_cost * n) {
+        // cheaper to test all the objects
+        return -1;
+    }
+    float lo = centroid_box.min[split_axis];
+    float scale = config.bins / (centroid_box.max[split_axis] - lo);
+    auto *mid = std::partition(prims.data() + start, prims.data() + end, [&](const BVHPrimitive &p) {
+        return bin_index(p.centroid[split_axis], lo, scale, config.bins) <= split_bin;
+    });
+    int m = mid - prims.data();
+    if (m == start || m == end) {
+        return split_median(prims, start, end, axis);
+    }
+    return m;
+}
+
+// one node of the flattened bvh, 32 bytes. nodes are stored depth first,
+// so the first child of an interior node is the next node in the array
+struct LinearBVHNode {
+    AABB box;
+    int offset;     // leaf: first primitive, interior: index of the second child
+    int count;      // number of primitives, 0 for interior nodes
+};
+#ifndef VECMATH_SSE
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should stay 32 bytes");
+#endif
+
+// a bvh packed in one array, built over BVHPrimitive records.
+// the owner keeps its primitives in the order of build(), leaves refer to ranges of it
+class LinearBVH {
 public:
-    BVHNode() {}
-    BVHNode(std::vector<Object3D*> &objects, int start, int end, double time0, double time1) {
-        // printf("Build BVH: %d %d", start, end);
-        
-        int axis = int(3 * RAND_UNIFORM);
-        if (axis == 0) {
-            std::sort(objects.begin() + start, objects.begin() + end, box_x_compare);
-        } else if (axis == 1) {
-            std::sort(objects.begin() + start, objects.begin() + end, box_y_compare);
-        } else {
-            std::sort(objects.begin() + start, objects.begin() + end, box_z_compare);
+    std::vector<LinearBVHNode> nodes;
+
+    // prims are reordered so that each leaf covers prims[offset, offset + count)
+    void build(std::vector<BVHPrimitive> &prims, const BVHConfig &config) {
+        nodes.clear();
+        if (prims.empty()) return;
+        int total = 0;
+        BuildNode *root = buildRecursive(prims, 0, prims.size(), config, 0, total);
+        nodes.reserve(total);
+        flatten(root);
+        delete root;
+    }
+
+    bool empty() const {
+        return nodes.empty();
+    }
+
+    const AABB &bounds() const {
+        return nodes[0].box;
+    }
+
+    // intersect_leaf(offset, count) tests a range of primitives against the ray and updates h
+    template <typename LeafFn>
+    bool intersect(const Ray &r, Hit &h, float tmin, LeafFn intersect_leaf) const {
+        if (nodes.empty()) return false;
+        float t_entry;
+        if (!nodes[0].box.intersect(r, tmin, h.getT(), t_entry)) return false;
+
+        // node index and the distance where the ray enters its box
+        int stack[BVH_STACK_SIZE];
+        float stack_t[BVH_STACK_SIZE];
+        int top = 0;
+        stack[top] = 0;
+        stack_t[top++] = t_entry;
+
+        bool hit = false;
+        while (top > 0) {
+            --top;
+            // a closer hit may have been found since the node was pushed
+            if (stack_t[top] > h.getT()) continue;
+            int index = stack[top];
+            const LinearBVHNode &node = nodes[index];
+            if (node.count > 0) {
+                hit |= intersect_leaf(node.offset, node.count);
+                continue;
+            }
+
+            int near = index + 1, far = node.offset;
+            float t_near, t_far;
+            bool hit_near = nodes[near].box.intersect(r, tmin, h.getT(), t_near);
+            bool hit_far = nodes[far].box.intersect(r, tmin, h.getT(), t_far);
+            if (hit_near && hit_far && t_far < t_near) {
+                std::swap(near, far);
+                std::swap(t_near, t_far);
+            }
+            // push the far child first so the near one is visited first
+            if (hit_far) {
+                stack[top] = far;
+                stack_t[top++] = t_far;
+            }
+            if (hit_near) {
+                stack[top] = near;
+                stack_t[top++] = t_near;
+            }
+        }
+        return hit;
+    }
+
+    // intersect on the lanes of mask of a packet, a node is visited while any of its lanes may still
+    // get a closer hit. intersect_leaf(offset, count, lanes) tests a range of primitives on those lanes
+    // and returns the lanes it hit. the children are visited in the order most of the lanes prefer
+    template <typename LeafFn>
+    int intersectPacket(const RayPacket &p, float tmin, int mask, LeafFn intersect_leaf) const {
+        if (nodes.empty()) return 0;
+        Float4 t_entry;
+        mask = p.intersect(nodes[0].box, tmin, mask, t_entry);
+        if (!mask) return 0;
+
+        int stack[BVH_STACK_SIZE];
+        int stack_mask[BVH_STACK_SIZE];
+        Float4 stack_t[BVH_STACK_SIZE];
+        int top = 0;
+        stack[top] = 0;
+        stack_mask[top] = mask;
+        stack_t[top++] = t_entry;
+
+        int hits = 0;
+        while (top > 0) {
+            --top;
+            int lanes = p.alive(stack_t[top], stack_mask[top]);
+            if (!lanes) continue;
+            int index = stack[top];
+            const LinearBVHNode &node = nodes[index];
+            if (node.count > 0) {
+                hits |= intersect_leaf(node.offset, node.count, lanes);
+                continue;
+            }
+
+            int near = index + 1, far = node.offset;
+            Float4 t_near, t_far;
+            int mask_near = p.intersect(nodes[near].box, tmin, lanes, t_near);
+            int mask_far = p.intersect(nodes[far].box, tmin, lanes, t_far);
+            int far_first = movemask(t_far < t_near) & mask_near & mask_far;
+            if (__builtin_popcount(far_first) * 2 > __builtin_popcount(mask_near & mask_far)) {
+                std::swap(near, far);
+                std::swap(t_near, t_far);
+                std::swap(mask_near, mask_far);
+            }
+            if (mask_far) {
+                stack[top] = far;
+                stack_mask[top] = mask_far;
+                stack_t[top++] = t_far;
+            }
+            if (mask_near) {
+                stack[top] = near;
+                stack_mask[top] = mask_near;
+                stack_t[top++] = t_near;
+            }
         }
+        return hits;
+    }
+
+    // any hit in [tmin, tmax): occluded_leaf(offset, count) returns whether a primitive of the range is hit,
+    // the traversal stops at the first one so the order of the children does not matter
+    template <typename LeafFn>
+    bool occluded(const Ray &r, float tmin, float tmax, LeafFn occluded_leaf) const {
+        if (nodes.empty()) return false;
+        float t_entry;
+        if (!nodes[0].box.intersect(r, tmin, tmax, t_entry)) return false;
+
+        int stack[BVH_STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const LinearBVHNode &node = nodes[stack[--top]];
+            if (node.count > 0) {
+                if (occluded_leaf(node.offset, node.count)) return true;
+                continue;
+            }
+            int first = &node - nodes.data() + 1, second = node.offset;
+            if (nodes[second].box.intersect(r, tmin, tmax, t_entry)) stack[top++] = second;
+            if (nodes[first].box.intersect(r, tmin, tmax, t_entry)) stack[top++] = first;
+        }
+        return false;
+    }
+
+private:
+    // temporary tree of the build, flattened afterwards
+    struct BuildNode {
+        AABB box;
+        BuildNode *left = nullptr;
+        BuildNode *right = nullptr;
+        int offset = 0, count = 0;
 
-        int n = end - start;
-        if (n == 1) {
-            left = right = objects[start];
-        } else if (n == 2) {
-            left = objects[start];
-            right = objects[start + 1];
+        ~BuildNode() {
+            delete left;
+            delete right;
+        }
+    };
+
+    BuildNode *buildRecursive(std::vector<BVHPrimitive> &prims, int start, int end, const BVHConfig &config,
+                              int depth, int &total) {
+        BuildNode *node = new BuildNode();
+        total++;
+        node->box = AABB::empty();
+        for (int i = start; i < end; i++) {
+            node->box.expand(prims[i].box);
+        }
+        int mid = bvh_split(prims, start, end, node->box, config, depth);
+        if (mid < 0) {
+            node->offset = start;
+            node->count = end - start;
         } else {
-            left = new BVHNode(objects, start, start + n / 2, time0, time1);
-            right = new BVHNode(objects, start + n / 2, end, time0, time1);
+            node->left = buildRecursive(prims, start, mid, config, depth + 1, total);
+            node->right = buildRecursive(prims, mid, end, config, depth + 1, total);
         }
+        return node;
+    }
 
-        AABB box_left, box_right;
-        if (!left->bounding_box(time0, time1, box_left) || !right->bounding_box(time0, time1, box_right)) {
-            std::cerr << "No bounding box in BVHNode constructor.\n";
+    int flatten(const BuildNode *node) {
+        int index = nodes.size();
+        nodes.push_back(LinearBVHNode());
+        nodes[index].box = node->box;
+        if (node->left == nullptr) {
+            nodes[index].offset = node->offset;
+            nodes[index].count = node->count;
+        } else {
+            flatten(node->left);
+            nodes[index].offset = flatten(node->right);
+            nodes[index].count = 0;
         }
-        box = AABB::surrounding_box(box_left, box_right);
+        return index;
+    }
+};
 
-        // printf("Build BVH: %d %d\n", start, end);
-        // printf("box: (%f, %f, %f) (%f, %f, %f)\n", box.min.x(), box.min.y(), box.min.z(), box.max.x(), box.max.y(), box.max.z());
-        // printf("box_left: (%f, %f, %f) (%f, %f, %f)\n", box_left.min.x(), box_left.min.y(), box_left.min.z(), box_left.max.x(), box_left.max.y(), box_left.max.z());
-        // printf("box_right: (%f, %f, %f) (%f, %f, %f)\n", box_right.min.x(), box_right.min.y(), box_right.min.z(), box_right.max.x(), box_right.max.y(), box_right.max.z());
+// a node of the 4 wide bvh, the boxes of the children are stored by component,
+// so one slab test on Float4 checks all of them
+struct BVH4Node {
+    Float4 bounds[6];   // min x, y, z then max x, y, z, lane i is child i
+    int child[4];       // leaf: first primitive, interior: index of the node
+    int count[4];       // leaf: number of primitives, 0 for interior nodes, -1 for an unused slot
+};
+
+// a LinearBVH collapsed to 4 children per node, for single rays.
+// the leaves are the leaves of the binary tree, so they refer to the same ranges of primitives
+class BVH4 {
+public:
+    std::vector<BVH4Node> nodes;
+
+    void build(const LinearBVH &bvh) {
+        nodes.clear();
+        if (bvh.empty()) return;
+        collapse(bvh, 0);
     }
 
-    bool intersect(const Ray &r, Hit &h, float tmin) override {
-        float t_min = tmin;
-        if (!box.intersect(r, t_min)) return false;
-        bool hit_left = left->intersect(r, h, tmin);
-        bool hit_right = right->intersect(r, h, tmin);
-        // printf("hit_left: %d, hit_right: %d\n", hit_left, hit_right);
-        return hit_left || hit_right;
+    bool empty() const {
+        return nodes.empty();
     }
 
-    bool bounding_box(double _time0, double _time1, AABB &output_box) override {
-        output_box = box;
-        return true;
+    // same as LinearBVH::intersect, the children that are hit are visited from the nearest
+    template <typename LeafFn>
+    bool intersect(const Ray &r, Hit &h, float tmin, LeafFn intersect_leaf) const {
+        if (nodes.empty()) return false;
+        SlabRay slab(r);
+
+        // a child to visit: node or leaf as in BVH4Node, and the distance where the ray enters it
+        struct Entry {
+            int child, count;
+            float t;
+        };
+        Entry stack[BVH4_STACK_SIZE];
+        int top = 0;
+        Entry entry = {0, 0, tmin};
+
+        bool hit = false;
+        while (true) {
+            if (entry.count > 0) {
+                hit |= intersect_leaf(entry.child, entry.count);
+            } else {
+                const BVH4Node &node = nodes[entry.child];
+                Float4 t_enter;
+                int mask = slab.intersect(node, tmin, h.getT(), t_enter);
+                // push the children that are hit sorted from far to near, the nearest ends on top
+                int first = top;
+                for (int i = 0; i < 4; i++) {
+                    // a NaN ray hits every box, unused slots included
+                    if (!(mask >> i & 1) || node.count[i] < 0) continue;
+                    Entry e = {node.child[i], node.count[i], t_enter[i]};
+                    int k = top++;
+                    for (; k > first && stack[k - 1].t < e.t; k--) stack[k] = stack[k - 1];
+                    stack[k] = e;
+                }
+            }
+            // a closer hit may have been found since an entry was pushed
+            do {
+                if (top == 0) return hit;
+                entry = stack[--top];
+            } while (entry.t > h.getT());
+        }
+    }
+
+    // same as LinearBVH::occluded
+    template <typename LeafFn>
+    bool occluded(const Ray &r, float tmin, float tmax, LeafFn occluded_leaf) const {
+        if (nodes.empty()) return false;
+        SlabRay slab(r);
+        int stack[BVH4_STACK_SIZE];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BVH4Node &node = nodes[stack[--top]];
+            Float4 t_enter;
+            int mask = slab.intersect(node, tmin, tmax, t_enter);
+            for (int i = 0; i < 4; i++) {
+                if (!(mask >> i & 1)) continue;
+                if (node.count[i] == 0) {
+                    stack[top++] = node.child[i];
+                } else if (node.count[i] > 0 && occluded_leaf(node.child[i], node.count[i])) {
+                    return true;
+                }
+            }
+        }
+        return false;
     }
 
 private:
-    Object3D *left;
-    Object3D *right;
-    AABB box;
+    // a node has up to 3 children on the stack for each level above it, plus the root entry
+    static constexpr int BVH4_STACK_SIZE = 3 * BVH_STACK_SIZE + 1;
+
+    // the parts of the ray used by the slab test, spread over the lanes once per traversal
+    struct SlabRay {
+        Float4 ox, oy, oz, inv_dx, inv_dy, inv_dz;
+        // index in BVH4Node::bounds of the planes the ray meets first and last on each axis
+        int near_x, near_y, near_z, far_x, far_y, far_z;
 
-    static inline bool box_compare(Object3D *a, Object3D *b, int axis) {
-        AABB box_a, box_b;
-        if (!a->bounding_box(0, 0, box_a) || !b->bounding_box(0, 0, box_b)) {
-            std::cerr << "No bounding box in BVHNode constructor.\n";
+        explicit SlabRay(const Ray &r) :
+            ox(r.origin.x()), oy(r.origin.y()), oz(r.origin.z()),
+            inv_dx(r.inv_direction.x()), inv_dy(r.inv_direction.y()), inv_dz(r.inv_direction.z()),
+            near_x(r.sign[0] ? 3 : 0), near_y(r.sign[1] ? 4 : 1), near_z(r.sign[2] ? 5 : 2),
+            far_x(3 - near_x), far_y(5 - near_y), far_z(7 - near_z) {}
+
+        // AABB::intersect against the 4 children, the children hit within [tmin, tmax] are returned.
+        // an unused slot has an inverted box, which is never hit
+        int intersect(const BVH4Node &node, float tmin, float tmax, Float4 &t_enter) const {
+            Float4 t0 = (node.bounds[near_x] - ox) * inv_dx;
+            Float4 t1 = (node.bounds[far_x] - ox) * inv_dx;
+            Float4 ty0 = (node.bounds[near_y] - oy) * inv_dy;
+            Float4 ty1 = (node.bounds[far_y] - oy) * inv_dy;
+            Float4 tz0 = (node.bounds[near_z] - oz) * inv_dz;
+            Float4 tz1 = (node.bounds[far_z] - oz) * inv_dz;
+            Float4 near(tmin), far(tmax);
+            near = select(t0 > near, t0, near);
+            near = select(ty0 > near, ty0, near);
+            near = select(tz0 > near, tz0, near);
+            far = select(t1 < far, t1, far);
+            far = select(ty1 < far, ty1, far);
+            far = select(tz1 < far, tz1, far);
+            t_enter = near;
+            return ~movemask(near > far) & 15;
+        }
+    };
+
+    // make a node from the binary subtree at index: open the interior child with the largest area
+    // until there are 4 children, then do the same for the interior children
+    int collapse(const LinearBVH &bvh, int index) {
+        const std::vector<LinearBVHNode> &binary = bvh.nodes;
+        int children[4];
+        int num_children = 0;
+        if (binary[index].count > 0) {
+            // a leaf at the root
+            children[num_children++] = index;
+        } else {
+            children[num_children++] = index + 1;
+            children[num_children++] = binary[index].offset;
+        }
+        while (num_children < 4) {
+            int best = -1;
+            float best_area = -1;
+            for (int i = 0; i < num_children; i++) {
+                const LinearBVHNode &child = binary[children[i]];
+                if (child.count == 0 && child.box.surface_area() > best_area) {
+                    best = i;
+                    best_area = child.box.surface_area();
+                }
+            }
+            if (best < 0) break;
+            int opened = children[best];
+            children[best] = opened + 1;
+            children[num_children++] = binary[opened].offset;
         }
-        return box_a.min[axis] < box_b.min[axis];
+
+        int node_index = nodes.size();
+        nodes.push_back(BVH4Node());
+        for (int i = 0; i < 4; i++) {
+            AABB box = AABB::empty();
+            int child = 0, count = -1;
+            if (i < num_children) {
+                const LinearBVHNode &binary_child = binary[children[i]];
+                box = binary_child.box;
+                if (binary_child.count > 0) {
+                    child = binary_child.offset;
+                    count = binary_child.count;
+                } else {
+                    child = collapse(bvh, children[i]);
+                    count = 0;
+                }
+            }
+            BVH4Node &node = nodes[node_index];
+            for (int axis = 0; axis < 3; axis++) {
+                node.bounds[axis][i] = box.min[axis];
+                node.bounds[3 + axis][i] = box.max[axis];
+            }
+            node.child[i] = child;
+            node.count[i] = count;
+        }
+        return node_index;
     }
+};
 
-    static bool box_x_compare(Object3D *a, Object3D *b) {
-        return box_compare(a, b, 0);
+// bvh over the finite objects of a group
+class BVHNode : public Object3D {
+public:
+    BVHNode() {}
+    BVHNode(std::vector<Object3D*> &objects, int start, int end, double time0, double time1,
+            const BVHConfig &config = BVHConfig()) {
+        // get the boxes once, instead of in every comparison
+        std::vector<BVHPrimitive> prims;
+        for (int i = start; i < end; i++) {
+            BVHPrimitive prim;
+            prim.index = i;
+            if (!objects[i]->bounding_box(time0, time1, prim.box)) {
+                std::cerr << "No bounding box in BVHNode constructor.\n";
+            }
+            prim.centroid = prim.box.centroid();
+            prims.push_back(prim);
+        }
+        bvh.build(prims, config);
+        for (const auto &prim : prims) {
+            leaf_objects.push_back(objects[prim.index]);
+        }
+        if (config.width == 4) {
+            wide.build(bvh);
+        }
+    }
+
+    bool intersect(const Ray &r, Hit &h, float tmin) override {
+        auto leaf = [&](int offset, int count) {
+            bool hit = false;
+            for (int i = offset; i < offset + count; i++) {
+                hit |= leaf_objects[i]->intersect(r, h, tmin);
+            }
+            return hit;
+        };
+        return wide.empty() ? bvh.intersect(r, h, tmin, leaf) : wide.intersect(r, h, tmin, leaf);
+    }
+
+    int intersectPacket(RayPacket &p, float tmin, int mask) override {
+        return bvh.intersectPacket(p, tmin, mask, [&](int offset, int count, int lanes) {
+            int hits = 0;
+            for (int i = offset; i < offset + count; i++) {
+                hits |= leaf_objects[i]->intersectPacket(p, tmin, lanes);
+            }
+            return hits;
+        });
     }
 
-    static bool box_y_compare(Object3D *a, Object3D *b) {
-        return box_compare(a, b, 1);
+    bool occluded(const Ray &r, float tmin, float tmax) override {
+        auto leaf = [&](int offset, int count) {
+            for (int i = offset; i < offset + count; i++) {
+                if (leaf_objects[i]->occluded(r, tmin, tmax)) return true;
+            }
+            return false;
+        };
+        return wide.empty() ? bvh.occluded(r, tmin, tmax, leaf) : wide.occluded(r, tmin, tmax, leaf);
     }
 
-    static bool box_z_compare(Object3D *a, Object3D *b) {
-        return box_compare(a, b, 2);
+    bool bounding_box(double _time0, double _time1, AABB &output_box) override {
+        if (bvh.empty()) return false;
+        output_box = bvh.bounds();
+        return true;
     }
-};
\ No newline at end of file
+
+    bool finite() override { return true; }
+
+private:
+    LinearBVH bvh;      // packets go through the binary tree, their box test is already 4 wide over the lanes
+    BVH4 wide;          // the same tree for single rays, unless the config asks for width 2
+    std::vector<Object3D*> leaf_objects;    // in leaf order
+};
@@ -7,6 +7,7 @@
 
 #include "ray.hpp"
 #include "rand.hpp"
+#include "sampler.hpp"
 
 
 class Camera {
@@ -22,7 +23,8 @@ public:
 
     // Generate rays for each screen-space coordinate
     virtual Ray generateRay(const Vector2f &point) = 0;
-    virtual Ray generateBlurRay(const Vector2f &point) = 0;
+    // the lens and the time come from sampler if given
+    virtual Ray generateBlurRay(const Vector2f &point, Sampler *sampler=nullptr) = 0;
     virtual ~Camera() = default;
 
     int getWidth() const { return width; }
@@ -77,19 +79,22 @@ public:
         return Ray(center, d_rw, time0 + rand_thres() * (time1 - time0));
     }
 
-    Ray generateBlurRay(const Vector2f &point) {
+    Ray generateBlurRay(const Vector2f &point, Sampler *sampler=nullptr) override {
+        Sampler independent;
+        if (!sampler) sampler = &independent;
         // d_rc
         float cx = (point.x() - this->cx) / fx * f;
         float cy = (this->cy - point.y()) / fy * f;
-        float dx = RAND_SIGNED * aperture;
-        float dy = RAND_SIGNED * aperture;
+        Vector2f lens = sampler->get2D();
+        float dx = (2 * lens.x() - 1) * aperture;
+        float dy = (2 * lens.y() - 1) * aperture;
 
         Vector3f d_rc = Vector3f(cx - dx, cy - dy, f);
         Matrix3f R(horizontal, -up, direction);
         // d_rw
         Vector3f d_rw = (R * d_rc).normalized();
 
-        return Ray(center + horizontal * dx - up * dy, d_rw, time0 + rand_thres() * (time1 - time0));
+        return Ray(center + horizontal * dx - up * dy, d_rw, time0 + sampler->get1D() * (time1 - time0));
     }
 
 private:
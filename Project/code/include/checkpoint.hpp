@@ -0,0 +1,92 @@
+/**
+ * Checkpoints written by a background thread
+ * the render threads only copy the color planes of the film, the means, the 8 bit encoding and the write
+ * are done by the writer thread while the next pass renders. the copies are reused once they are written
+*/
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "film.hpp"
+
+class CheckpointWriter {
+public:
+    CheckpointWriter() = default;
+    CheckpointWriter(const CheckpointWriter &) = delete;
+    CheckpointWriter &operator=(const CheckpointWriter &) = delete;
+
+    ~CheckpointWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        ready.notify_one();
+        if (worker.joinable()) worker.join();
+    }
+
+    // save the image of film as it is now to filename as a bmp, returns once the film is copied
+    void save(const Film &film, const std::string &filename) {
+        std::unique_ptr<Film> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!spare.empty()) {
+                snapshot = std::move(spare.back());
+                spare.pop_back();
+            }
+        }
+        if (!snapshot) snapshot.reset(new Film(film.getWidth(), film.getHeight()));
+        snapshot->copyColor(film);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(Job{filename, std::move(snapshot)});
+            if (!worker.joinable()) worker = std::thread(&CheckpointWriter::run, this);
+        }
+        ready.notify_one();
+    }
+
+    // block until the checkpoints asked for so far are on disk
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return jobs.empty() && !busy; });
+    }
+
+private:
+    struct Job {
+        std::string filename;
+        std::unique_ptr<Film> film;
+    };
+
+    std::mutex mutex;
+    std::condition_variable ready, done;
+    std::deque<Job> jobs;
+    std::vector<std::unique_ptr<Film>> spare;   // snapshots already written
+    bool busy = false;
+    bool stop = false;
+    std::thread worker;     // started by the first checkpoint
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            ready.wait(lock, [&]() { return stop || !jobs.empty(); });
+            if (jobs.empty()) return;
+            Job job = std::move(jobs.front());
+            jobs.pop_front();
+            busy = true;
+            lock.unlock();
+            if (!job.film->saveBMP(job.filename.c_str())) {
+                fprintf(stderr, "Cannot write checkpoint %s\n", job.filename.c_str());
+            }
+            lock.lock();
+            spare.push_back(std::move(job.film));
+            busy = false;
+            done.notify_all();
+        }
+    }
+};
@@ -15,6 +15,12 @@ struct CurvePoint {
     Vector3f T; // Tangent  (unit)
 };
 
+// a piece of a curve over [phi0, phi1] as a bezier, the piece is inside the convex hull of the controls
+struct BezierPiece {
+    std::vector<Vector3f> controls;
+    float phi0, phi1;
+};
+
 class Curve : public Object3D {
 protected:
     std::vector<Vector3f> controls;
@@ -30,20 +36,47 @@ public:
     }
     
     // get the point on the curve at parameter phi
-    virtual CurvePoint getPoint(float phi) = 0;
+    virtual CurvePoint getPoint(float phi) const = 0;
     // lower bound and upper bound for parameter phi
     virtual float lowerBound() = 0;
     virtual float upperBound() = 0;
+    // the curve as bezier pieces, in the order of phi
+    virtual std::vector<BezierPiece> bezierPieces() const = 0;
 
     bool bounding_box(double time0, double time1, AABB &output_box) override {
         return false;
     }
 };
 
+// the binomial coefficient n over i, a constant when n and i are
+constexpr float binomial(int n, int i) {
+    return i <= 0 ? 1 : binomial(n, i - 1) * (n - i + 1) / i;
+}
+
+// step I of the horner pass over the bernstein basis of degree N: the point takes control I, the tangent
+// the difference I of the controls. the coefficients of a step are constants
+template <int N, int I>
+struct BezierHorner {
+    static inline void step(const Vector3f *p, float t, float s, float tp, Vector3f &v, Vector3f &d) {
+        constexpr float cv = binomial(N, I), cd = binomial(N - 1, I);
+        tp *= t;
+        v = s * v + (cv * tp) * p[I];
+        d = s * d + (cd * tp) * (p[I + 1] - p[I]);
+        BezierHorner<N, I + 1>::step(p, t, s, tp, v, d);
+    }
+};
+
+// the last control, the tangent is one degree less
+template <int N>
+struct BezierHorner<N, N> {
+    static inline void step(const Vector3f *p, float t, float s, float tp, Vector3f &v, Vector3f &d) {
+        v = s * v + (tp * t) * p[N];
+    }
+};
+
 class BezierCurve : public Curve {
 public:
-    double **C;
-    int n, k;
+    int n;
 
     explicit BezierCurve(const std::vector<Vector3f> &points) : Curve(points) {
         if (points.size() < 4 || points.size() % 3 != 1) {
@@ -51,29 +84,38 @@ public:
             exit(0);
         }
         n = points.size() - 1;
-        k = n;
-        init_C();
+        // for the degrees without a specialised pass
+        cv.resize(n + 1);
+        cd.resize(n);
+        for (int i = 0; i <= n; i++) {
+            cv[i] = binomial(n, i);
+            if (i < n) cd[i] = binomial(n - 1, i);
+        }
     }
 
-    ~BezierCurve() override {
-        delete_C();
+    // the point and the tangent in one horner pass, (1-t) is multiplied in at each control
+    CurvePoint getPoint(float phi) const override {
+        const Vector3f *p = controls.data();
+        switch (n) {
+        case 3: return horner<3>(p, phi);
+        case 6: return horner<6>(p, phi);
+        case 9: return horner<9>(p, phi);
+        }
+        float s = 1 - phi, tp = 1;
+        Vector3f v = p[0], d = p[1] - p[0];
+        for (int i = 1; i < n; i++) {
+            tp *= phi;
+            v = s * v + (cv[i] * tp) * p[i];
+            d = s * d + (cd[i] * tp) * (p[i + 1] - p[i]);
+        }
+        CurvePoint cp;
+        cp.V = s * v + (tp * phi) * p[n];
+        cp.T = n * d;
+        return cp;
     }
 
-    CurvePoint getPoint(float phi) {
-        // printf("get point %f\n", phi);
-        CurvePoint point;
-        point.V = Vector3f(0, 0, 0);
-        point.T = Vector3f(0, 0, 0);
-        for (int i = 0; i <= n; i++) {
-            // printf("i = %d\n", i);
-            // printf("B(i, k, phi) = %f\n", B(i, k, phi));
-            // printf("dB(i, k, phi) = %f\n", dB(i, k, phi));
-
-            point.V += B(i, k, phi) * controls[i];
-            point.T += dB(i, k, phi) * controls[i];
-        }
-        // printf("get point done\n");
-        return point;
+    std::vector<BezierPiece> bezierPieces() const override {
+        return std::vector<BezierPiece>(1, BezierPiece{controls, 0, 1});
     }
 
     // useless now
@@ -156,57 +198,6 @@ public:
     //     return B;
     // }
 
-    void init_C() {
-        C = new double*[n + 1];
-        for (int i = 0; i <= n; i++) {
-            C[i] = new double[k + 1];
-            if (i == 0) {
-                for (int j = 1; j <= k; j++) {
-                    C[i][j] = 0;
-                }
-                C[i][0] = 1;
-            } else {
-                for (int j = 0; j <= k; j++) {
-                    C[i][j] = C[i - 1][j];
-                    if (j > 0) {
-                        C[i][j] += C[i - 1][j - 1];
-                    }
-                }
-            }
-        }
-    }
-    
-    void delete_C() {
-        for (int i = 0; i <= n; i++) {
-            delete[] C[i];
-        }
-        delete[] C;
-    }
-
-    // int C(int n, int k) {
-    //     // compute Cnk
-    //     int result = 1;
-    //     for (int i = 1; i <= k; i++) {
-    //         result *= (n - i + 1);
-    //     }
-    //     for (int i = 1; i <= k; i++) {
-    //         result /= i;
-    //     }
-    //     return result;
-    // }
-
-    float B(int i, int n, float t) {
-        // compute Bi(t)
-        // printf("C: ");
-        // printf("%d, %d, %f\n", i, n, t);
-        // printf("%f %f, %f", C[n][i], pow(t, i), pow(1 - t, n - i) );
-        return C[n][i] * pow(t, i) * pow(1 - t, n - i);
-    }
-
-    float dB(int i, int n, float t) {
-        return n * (B(i-1, n-1, t) - B(i, n-1, t));
-    }
-
     float lowerBound() {
         return 0;
     }
@@ -219,12 +210,23 @@ protected:
     // std::vector<float> knots;
     // std::vector<std::vector<float>> B;
     // std::vector<std::vector<bool>> bitmap;
+    std::vector<float> cv, cd;  // binomials of n and n - 1
+
+    template <int N>
+    static CurvePoint horner(const Vector3f *p, float t) {
+        Vector3f v = p[0], d = p[1] - p[0];
+        BezierHorner<N, 1>::step(p, t, 1 - t, 1, v, d);
+        CurvePoint cp;
+        cp.V = v;
+        cp.T = N * d;
+        return cp;
+    }
 };
 
 class BsplineCurve : public Curve {
 public:
-    float* B, *dB;
-    int n, k;
+    int n;
+    constexpr static int k = 3;  // for max pow of 3
 
     BsplineCurve(const std::vector<Vector3f> &points) : Curve(points) {
         if (points.size() < 4) {
@@ -232,52 +234,34 @@ public:
             exit(0);
         }
         n = points.size() - 1;
-        k = 3;  // for max pow of 3
 
-        this->knots = std::vector<float>(n + k + 1, 0);
-        for (int i = 0; i < n + k + 1; i++) {
+        // t0 ~ t(n+k+1), uniform
+        this->knots = std::vector<float>(n + k + 2, 0);
+        for (int i = 0; i < n + k + 2; i++) {
             knots[i] = (float)i / (n + k + 1);
         }
-
-        B = new float[n + k + 1];
-        dB = new float[n + k + 1];
     }
 
-    ~BsplineCurve() {
-        delete[] B;
-        delete[] dB;
-    }
-
-    CurvePoint getPoint(float phi) {
+    // de boor's algorithm on the k+1 control points of the span of phi, on the stack so that the threads
+    // can share the curve. the tangent comes from the points one step before the last
+    CurvePoint getPoint(float phi) const override {
+        int mu = span(phi);
+        Vector3f d[k + 1];
+        for (int j = 0; j <= k; j++) {
+            d[j] = controls[mu - k + j];
+        }
         CurvePoint cp;
-        cp.V = Vector3f(0, 0, 0);
-        cp.T = Vector3f(0, 0, 0);
-
-        // for Ni1
-        for (int i = 0; i < n + k + 1; i++) {
-            if (phi >= knots[i] && phi < knots[i + 1]) {
-                B[i] = 1;
-            } else {
-                B[i] = 0;
+        for (int r = 1; r <= k; r++) {
+            if (r == k) {
+                cp.T = (k / (knots[mu + 1] - knots[mu])) * (d[k] - d[k - 1]);
             }
-        }
-
-        // for Ni2, Ni3, ..., Nik
-        for (int j = 1; j <= k; j++) {  // the final k loop for computing the k = 4
-            for (int i = 0; i < n + k + 1; i++) {
-                if (j == k) {
-                    // compute dB
-                    dB[i] = k * (B[i] / (knots[i + k] - knots[i]) - B[i + 1] / (knots[i + k + 1] - knots[i + 1]));
-                }
-                B[i] = B[i] * (phi - knots[i]) / (knots[i + j] - knots[i]) + B[i + 1] * (knots[i + j + 1] - phi) / (knots[i + j + 1] - knots[i + 1]);
+            for (int j = k; j >= r; j--) {
+                int i = mu - k + j;
+                float a = (phi - knots[i]) / (knots[i + k + 1 - r] - knots[i]);
+                d[j] = (1 - a) * d[j - 1] + a * d[j];
             }
         }
-
-        // compute V and T
-        for (int i = 0; i <= n; i++) {
-            cp.V += B[i] * controls[i];
-            cp.T += dB[i] * controls[i];
-        }
+        cp.V = d[k];
         return cp;
     }
 
@@ -289,6 +273,18 @@ public:
         return knots[n + 1];
     }
 
+    // one cubic bezier per span, by the matrix of the uniform cubic b-spline
+    std::vector<BezierPiece> bezierPieces() const override {
+        std::vector<BezierPiece> pieces;
+        for (int mu = k; mu <= n; mu++) {
+            const Vector3f &p0 = controls[mu - 3], &p1 = controls[mu - 2], &p2 = controls[mu - 1], &p3 = controls[mu];
+            std::vector<Vector3f> bezier = {(p0 + 4 * p1 + p2) / 6, (4 * p1 + 2 * p2) / 6, (2 * p1 + 4 * p2) / 6,
+                                            (p1 + 4 * p2 + p3) / 6};
+            pieces.push_back(BezierPiece{bezier, knots[mu], knots[mu + 1]});
+        }
+        return pieces;
+    }
+
     // void discretize(int resolution, std::vector<CurvePoint>& data) override {
     //     data.clear();
     //     // TODO (PA2): fill in data vector
@@ -366,6 +362,12 @@ protected:
     std::vector<float> knots;
     // std::vector<std::vector<float>> B;
     // std::vector<std::vector<bool>> bitmap;
+
+    // the span [knots[mu], knots[mu + 1]) of phi, by binary search. clamped to the spans of the curve,
+    // k ~ n, so the ends extend the first and the last piece
+    int span(float phi) const {
+        return std::upper_bound(knots.begin() + k + 1, knots.begin() + n + 1, phi) - knots.begin() - 1;
+    }
 };
 
 #endif // CURVE_HPP
@@ -0,0 +1,151 @@
+/**
+ * Accumulation buffer of a render
+ * one float plane per channel and a plane of sample counts, a pixel is its sum over its count, so the
+ * samples can come in any number of passes and nothing is rescaled in place. optional planes (aovs) keep
+ * the moments of the luminance for the variance, and the albedo and the normal of the first hits.
+ * a checkpoint writes the means row by row straight to the file
+*/
+#pragma once
+
+#include <vector>
+#include <cfloat>
+#include <cmath>
+#include <vecmath.h>
+
+#include "image.hpp"
+
+inline float luminance(const Vector3f &c) {
+    return 0.2126f * c.x() + 0.7152f * c.y() + 0.0722f * c.z();
+}
+
+class Film {
+public:
+    enum { AOV_VARIANCE = 1, AOV_ALBEDO = 2, AOV_NORMAL = 4 };
+    enum Channel { COLOR, VARIANCE, ALBEDO, NORMAL };
+
+    Film(int width, int height) : width(width), height(height) {
+        reset(0);
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getAOVs() const { return aovs; }
+
+    // zero the planes for a new render, the ones already there are reused
+    void reset(int aovs) {
+        this->aovs = aovs;
+        int n = width * height;
+        r.assign(n, 0); g.assign(n, 0); b.assign(n, 0);
+        count.assign(n, 0);
+        resize(lum, aovs & AOV_VARIANCE);
+        resize(lum_sq, aovs & AOV_VARIANCE);
+        for (int c = 0; c < 3; c++) {
+            resize(albedo[c], aovs & AOV_ALBEDO);
+            resize(normal[c], aovs & AOV_NORMAL);
+        }
+    }
+
+    // one sample of pixel p = y * width + x
+    void addSample(int p, const Vector3f &color) {
+        r[p] += color.x(); g[p] += color.y(); b[p] += color.z();
+        count[p]++;
+        if (aovs & AOV_VARIANCE) {
+            double l = luminance(color);
+            lum[p] += l;
+            lum_sq[p] += l * l;
+        }
+    }
+
+    // n samples of pixel p summed by the caller, they do not count in the variance
+    void addSamples(int p, const Vector3f &sum, int n) {
+        r[p] += sum.x(); g[p] += sum.y(); b[p] += sum.z();
+        count[p] += n;
+    }
+
+    // the first hit of one sample of pixel p, averaged over the samples like the color
+    void addFeatures(int p, const Vector3f &a, const Vector3f &n) {
+        if (aovs & AOV_ALBEDO) {
+            albedo[0][p] += a.x(); albedo[1][p] += a.y(); albedo[2][p] += a.z();
+        }
+        if (aovs & AOV_NORMAL) {
+            normal[0][p] += n.x(); normal[1][p] += n.y(); normal[2][p] += n.z();
+        }
+    }
+
+    int samples(int p) const { return count[p]; }
+
+    // the color and the counts of other, of the same size, without its aovs. the planes are reused
+    void copyColor(const Film &other) {
+        aovs = 0;
+        r = other.r; g = other.g; b = other.b;
+        count = other.count;
+    }
+
+    // the mean of pixel (x, y)
+    Vector3f getPixel(int x, int y) const {
+        return get(COLOR, y * width + x);
+    }
+
+    // the mean of a channel at pixel p, black for the planes not kept. the variance is the one of the
+    // mean luminance in all three components, the normal is mapped to 0 ~ 1
+    Vector3f get(Channel channel, int p) const {
+        int n = count[p];
+        if (n == 0) return Vector3f::ZERO;
+        switch (channel) {
+        case COLOR:
+            return Vector3f(r[p], g[p], b[p]) / n;
+        case VARIANCE:
+            if (!(aovs & AOV_VARIANCE) || n < 2) return Vector3f::ZERO;
+            return Vector3f(variance(p) / n);
+        case ALBEDO:
+            if (!(aovs & AOV_ALBEDO)) return Vector3f::ZERO;
+            return Vector3f(albedo[0][p], albedo[1][p], albedo[2][p]) / n;
+        case NORMAL:
+            if (!(aovs & AOV_NORMAL)) return Vector3f::ZERO;
+            return Vector3f(normal[0][p], normal[1][p], normal[2][p]) / (2.0f * n) + Vector3f(0.5f);
+        }
+        return Vector3f::ZERO;
+    }
+
+    // standard error of the mean luminance over the mean, pixels darker than 0.01 count as 0.01.
+    // needs the variance planes
+    float relativeError(int p) const {
+        int n = count[p];
+        if (n < 2) return FLT_MAX;
+        double mean = lum[p] / n;
+        return sqrt(variance(p) / n) / fmax(mean, 0.01);
+    }
+
+    // a checkpoint or the final image, the means are computed row by row as the file is written
+    bool saveBMP(const char *filename, Channel channel = COLOR) const {
+        return SaveBMP(filename, width, height, [&](int y, Vector3f *colors) {
+            for (int x = 0; x < width; x++) {
+                colors[x] = get(channel, y * width + x);
+            }
+        });
+    }
+
+private:
+    int width, height;
+    int aovs = 0;
+    std::vector<float> r, g, b;
+    std::vector<int> count;
+    std::vector<double> lum, lum_sq;    // of the luminance of the samples
+    std::vector<float> albedo[3], normal[3];
+
+    // sample variance of the luminance
+    double variance(int p) const {
+        int n = count[p];
+        double mean = lum[p] / n;
+        return fmax(0.0, (lum_sq[p] - lum[p] * mean) / (n - 1));
+    }
+
+    template <typename T>
+    void resize(std::vector<T> &plane, bool keep) {
+        if (keep) {
+            plane.assign(width * height, 0);
+        } else {
+            plane.clear();
+        }
+    }
+};
@@ -15,6 +15,7 @@ class Group : public Object3D {
 
 public:
     bool use_bvh = false;
+    BVHConfig bvh_config;
     std::vector<Object3D*> finite_objects;
     std::vector<Object3D*> infinite_objects;
 
@@ -37,7 +38,7 @@ public:
         // printf("group tmin = %f\n", tmin);
         if (use_bvh) {
             // check all the finite objects
-            if (root->intersect(r, h, tmin)) {
+            if (root && root->intersect(r, h, tmin)) {
                 isIntersect = true;
                 // printf("intersect with bvh\n");
                 // printf("tmin = %f\n", tmin);
@@ -61,6 +62,44 @@ public:
         return isIntersect;
     }
 
+    // the same objects in the same order as intersect, on the lanes of a packet
+    int intersectPacket(RayPacket &p, float tmin, int mask) override {
+        int hits = 0;
+        if (use_bvh) {
+            if (root) {
+                hits |= root->intersectPacket(p, tmin, mask);
+            }
+            for (int i = 0; i < (int) infinite_objects.size(); i++) {
+                hits |= infinite_objects[i]->intersectPacket(p, tmin, mask);
+            }
+        } else {
+            for (int i = 0; i < group_size; i++) {
+                if (objects[i]) {
+                    hits |= objects[i]->intersectPacket(p, tmin, mask);
+                }
+            }
+        }
+        return hits;
+    }
+
+    bool occluded(const Ray &r, float tmin, float tmax) override {
+        if (use_bvh) {
+            // the infinite objects are few and cheap, try them before the tree
+            for (int i = 0; i < (int) infinite_objects.size(); i++) {
+                if (infinite_objects[i]->occluded(r, tmin, tmax)) {
+                    return true;
+                }
+            }
+            return root && root->occluded(r, tmin, tmax);
+        }
+        for (int i = 0; i < group_size; i++) {
+            if (objects[i] && objects[i]->occluded(r, tmin, tmax)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     bool bounding_box(double _time0, double _time1, AABB &output_box) override {
         if (group_size < 1) return false;
         AABB temp_box;
@@ -113,7 +152,9 @@ public:
                     }
                 }
 
-                root = new BVHNode(finite_objects, 0, finite_objects.size(), t0, t1);
+                if (!finite_objects.empty()) {
+                    root = new BVHNode(finite_objects, 0, finite_objects.size(), t0, t1, bvh_config);
+                }
             }
         }
     }
@@ -134,7 +175,7 @@ public:
 private:
     int group_size;
     std::vector<Object3D*> objects;
-    BVHNode *root;
+    BVHNode *root = nullptr;
 };
 
 #endif
@@ -5,6 +5,7 @@
 #include "ray.hpp"
 
 class Material;
+class Object3D;
 
 class Hit {
 public:
@@ -12,12 +13,14 @@ public:
     // constructors
     Hit() {
         material = nullptr;
+        object = nullptr;
         t = 1e38;
     }
 
     Hit(float _t, Material *m, const Vector3f &n, double _u = 0, double _v = 0) {
         t = _t;
         material = m;
+        object = nullptr;
         normal = n;
         u = _u;
         v = _v;
@@ -26,6 +29,7 @@ public:
     Hit(const Hit &h) {
         t = h.t;
         material = h.material;
+        object = h.object;
         normal = h.normal;
         u = h.u;
         v = h.v;
@@ -57,6 +61,7 @@ public:
     void set(float _t, Material *m, const Vector3f &n, double _u = 0, double _v = 0) {
         t = _t;
         material = m;
+        object = nullptr;
         normal = n;
         u = _u;
         v = _v;
@@ -65,6 +70,7 @@ public:
 public:
     float t;
     Material *material;
+    Object3D *object;   // the object hit if it can be sampled as a light, set after set(), else null
     Vector3f normal;
 
     double u, v; // texture coordinates
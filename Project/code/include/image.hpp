@@ -2,6 +2,8 @@
 #define IMAGE_H
 
 #include <cassert>
+#include <functional>
+#include <vector>
 #include <vecmath.h>
 
 // Simple image class
@@ -65,4 +67,14 @@ private:
 
 };
 
+// 24 bit bmp of width x height pixels without an image in memory, row(y, colors) fills the width colors
+// of row y, one row at a time
+int SaveBMP(const char *filename, int width, int height, const std::function<void(int, Vector3f *)> &row);
+
+// the same bmp as the bytes of the file
+std::vector<unsigned char> EncodeBMP(int width, int height, const std::function<void(int, Vector3f *)> &row);
+
+// bytes to filename with one write, 0 if it failed
+int WriteFile(const char *filename, const std::vector<unsigned char> &bytes);
+
 #endif // IMAGE_H
@@ -9,6 +9,8 @@
 #include "hit.hpp"
 #include "texture.hpp"
 #include "rand.hpp"
+#include "sampler.hpp"
+#include "sampling.hpp"
 
 inline float rand_thres() {
     // 0 ~ 1
@@ -145,15 +147,27 @@ public:
         return I - 2 * Vector3f::dot(I, N) * N;
     }
 
-    Vector3f random_unit_vector() {
-        while (true) {
-            Vector3f p = Vector3f(2*rand_thres() - 1, 2*rand_thres() - 1, 2*rand_thres() - 1);
-            if (p.squaredLength() >= 1) continue;
-            return p.normalized();
+    // the diffuse lobe from a 2d sample: cosine weighted around the normal of a surface, uniform in all
+    // directions at a media hit, which has no normal
+    static Vector3f sampleDiffuse(const Vector3f &normal, const Vector2f &u) {
+        if (normal.squaredLength() < 0.5f) {
+            return uniform_sphere(u.x(), u.y());
         }
+        return cosine_hemisphere(normal.normalized(), u.x(), u.y());
     }
 
-    bool scatter(const Ray &ray, Hit &hit, Vector3f &attenuation, Ray &scattered, bool front=true) {
+    // solid angle pdf of sampleDiffuse on a surface with unit normal n, given the diffuse lobe was picked.
+    // the specular and refract lobes are deltas, they have no pdf to weight against
+    static float diffusePdf(const Vector3f &n, const Vector3f &dir) {
+        return cosine_hemisphere_pdf(Vector3f::dot(n, dir));
+    }
+
+    // diffuse is set to whether the diffuse lobe was picked, for next event estimation.
+    // the random numbers come from sampler, 3 dimensions per call, or from the generator of the thread
+    bool scatter(const Ray &ray, Hit &hit, Vector3f &attenuation, Ray &scattered, bool front=true,
+                 bool *diffuse=nullptr, Sampler *sampler=nullptr) {
+        if (diffuse) *diffuse = false;
+        if (!sampler) sampler = &independent_sampler();
         Vector3f textureColor = Vector3f::ZERO;
         // get the texture before bump and normal
         if (texture != nullptr) {
@@ -172,10 +186,11 @@ public:
             hit.normal = norm;
         }
 
-        // get a rand threshold to determine the type of scattering
-        float rand = rand_thres();
+        // get a rand threshold to determine the type of scattering, then the sample of the lobe
+        float rand = sampler->get1D();
+        Vector2f u = sampler->get2D();
         if (rand < ratio.getDiffuseThres()) {
-            Vector3f target = hit.getNormal() + random_unit_vector();
+            Vector3f direction = sampleDiffuse(hit.getNormal(), u);
 
             Vector3f p = ray.pointAtParameter(hit.getT());
 
@@ -184,13 +199,14 @@ public:
                 // printf("height: %f\n", height);
                 p += front ? bumpRatio * height * hit.getNormal() : -bumpRatio * height * hit.getNormal();
             }
-            scattered = Ray(p, target.normalized(), ray.time);
+            scattered = Ray(p, direction, ray.time);
             attenuation = diffuseColor;
 
             // If there is a texture, use the texture color
             if (texture != nullptr) {
                 attenuation = attenuation * textureColor;
             }
+            if (diffuse) *diffuse = true;
             return true;
         } else if (rand < ratio.getSpecularThres()) {
             // specular
@@ -235,7 +251,7 @@ public:
                 direction = reflect(unit_direction, norm);
             } else {
                 float R = R0 + (1 - R0) * pow(1 - cos_theta, 5);
-                if (rand_thres() < R) {
+                if (u.x() < R) {
                     direction = reflect(unit_direction, norm);
                 } else {
                     // printf("refract\n");
@@ -7,6 +7,7 @@
 #include "ray.hpp"
 #include "hit.hpp"
 #include "rand.hpp"
+#include "sampler.hpp"
 
 class Media : public Object3D {
     Object3D *obj;
@@ -44,7 +45,10 @@ public:
             // compute 
             float len = r.getDirection().length();
             float dis_inside_boundary = (h2.getT() - h1.getT()) * len;
-            float hit_distance = - inv_density * log(RAND_UNIFORM);
+            // the sampler of the path if the renderer set one, see thread_sampler
+            Sampler *sampler = thread_sampler();
+            float u = sampler ? sampler->get1D() : RAND_UNIFORM;
+            float hit_distance = - inv_density * log(1 - u);
             // printf("hit_distance = %f\n", hit_distance);
             // printf("dis_inside_boundary = %f\n", dis_inside_boundary);
             if (hit_distance < dis_inside_boundary) {
@@ -8,29 +8,42 @@
 #include "Vector2f.h"
 #include "Vector3f.h"
 #include "bounding.hpp"
+#include "bvh.hpp"
 
 
 class Mesh : public Object3D {
 
 public:
-    Mesh(const char *filename, Material *m, bool use_inter=false);
+    Mesh(const char *filename, Material *m, bool use_inter=false, const BVHConfig &config = BVHConfig());
 
     struct TriangleIndex {
         TriangleIndex() {
             x[0] = 0; x[1] = 0; x[2] = 0;
         }
+        TriangleIndex(int a, int b, int c) {
+            x[0] = a; x[1] = b; x[2] = c;
+        }
         int &operator[](const int i) { return x[i]; }
         // By Computer Graphics convention, counterclockwise winding is front face
         int x[3]{};
     };
 
+    // a mesh built in memory, with a normal and texture coordinates per vertex, interpolated over the
+    // triangles
+    Mesh(std::vector<Vector3f> vertices, std::vector<Vector3f> normals, std::vector<Vector2f> uvs,
+         std::vector<TriangleIndex> triangles, Material *m, const BVHConfig &config = BVHConfig());
+
     std::vector<Vector3f> v;
     std::vector<Vector3f> vn;
     std::vector<TriangleIndex> t;
+    std::vector<TriangleIndex> tn;  // indices into vn of the corners, for use_inter
     std::vector<Vector3f> n;
+    std::vector<Vector2f> uv;       // per vertex, the hits get no texture coordinates without
     bool use_inter;
 
     bool intersect(const Ray &r, Hit &h, float tmin) override;
+    bool occluded(const Ray &r, float tmin, float tmax) override;
+    int intersectPacket(RayPacket &p, float tmin, int mask) override;
     bool bounding_box(double time0, double time1, AABB &output_box) { 
         // the bounding box is outside the all triangles
         if (box == nullptr) {
@@ -52,11 +65,39 @@ public:
     }
 
     bool finite() override { return true; }
+
+    // uniform over the total area, a triangle is picked by its area
+    bool sampleLight(const Vector3f &p, const Vector2f &u, Vector3f &dir, float &dist, float &pdf) override;
+    float lightPdf(const Ray &r, float &t) override;
 private:
     AABB* box = nullptr;
 
+    // triangle level bvh, built once after loading. single rays use the 4 wide version unless the config
+    // asks for width 2, packets always the binary one
+    LinearBVH bvh;
+    BVH4 wide;
+    int width = 4;
+
+    // running sum of the triangle areas in the order of t, for light sampling
+    std::vector<float> area_cdf;
+
     // Normal can be used for light estimation
     void computeNormal();
+
+    // sorts t (and n) so that each leaf covers a contiguous range
+    void buildBVH(const BVHConfig &config = BVHConfig());
+    // intersect, with the index of the triangle hit
+    bool intersectNearest(const Ray &r, Hit &h, float tmin, int &triId);
+    bool intersectTriangle(int triId, const Ray &r, Hit &h, float tmin);
+    void setTriangleHit(int triId, Hit &h, float tt, float beta, float gamma);
+    // the shared test: t in [tmin, tmax] and the barycentric coordinates of the hit
+    bool hitTriangle(int triId, const Ray &r, float tmin, float tmax, float &tt, float &beta, float &gamma) const;
+    // hitTriangle on the lanes of a packet, returns the lanes that hit closer than their current hit
+    int hitTrianglePacket(int triId, const RayPacket &p, float tmin, int mask, Float4 &tt, Float4 &beta,
+                          Float4 &gamma) const;
+    void computeAreas();
+    // unit normal of the plane of a triangle, whatever the shading normals
+    Vector3f faceNormal(int triId) const;
 };
 
 #endif
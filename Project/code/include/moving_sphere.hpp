@@ -85,6 +85,21 @@ public:
     double t0, t1;
 
     bool finite() override { return true; }
+
+    // the center depends on the time of the ray, go through intersect instead of the static sphere test
+    bool occluded(const Ray &r, float tmin, float tmax) override {
+        return Object3D::occluded(r, tmin, tmax);
+    }
+
+    int intersectPacket(RayPacket &p, float tmin, int mask) override {
+        return Object3D::intersectPacket(p, tmin, mask);
+    }
+
+    // the center depends on the time of the ray, so it is not sampled as a light
+    bool sampleLight(const Vector3f &p, const Vector2f &u, Vector3f &dir, float &dist, float &pdf) override {
+        return false;
+    }
+    float lightPdf(const Ray &r, float &t) override { return 0; }
 protected:
     Vector3f center2;
 };
@@ -0,0 +1,19 @@
+/**
+ * OBJ loader for the meshes
+ * the file is memory mapped and cut into chunks at line ends, the chunks are parsed in parallel.
+ * the result is cached next to the file in <file>.meshbin, which is used while the obj is unchanged
+ */
+#pragma once
+
+#include <vector>
+#include <Vector3f.h>
+
+struct ObjData {
+    std::vector<Vector3f> v;
+    std::vector<Vector3f> vn;
+    std::vector<int> faces;         // 3 vertex indices per triangle, polygons are split into fans
+    std::vector<int> face_normals;  // 3 normal indices per triangle, -1 where the face gives none
+};
+
+// false if the file cannot be read
+bool load_obj(const char *filename, ObjData &data, bool use_cache = true);
@@ -5,6 +5,8 @@
 #include "hit.hpp"
 #include "material.hpp"
 #include "bounding.hpp"
+#include "packet.hpp"
+#include "sampler.hpp"
 
 // Base class for all 3d entities.
 class Object3D {
@@ -21,6 +23,45 @@ public:
     virtual bool intersect(const Ray &r, Hit &h, float tmin) = 0;
     virtual bool bounding_box(double time0, double time1, AABB &output_box) = 0;
     virtual bool finite() { return false; }
+
+    // Whether anything of the object is hit at tmin <= t < tmax, for shadow rays.
+    // Stops at the first hit found and fills in nothing, objects override it with a cheaper test.
+    virtual bool occluded(const Ray &r, float tmin, float tmax) {
+        Hit h;
+        h.t = tmax;
+        return intersect(r, h, tmin) && h.getT() < tmax;
+    }
+
+    // Intersect the lanes of mask of a packet, returns the lanes that got a closer hit.
+    // The default traces the lanes one by one, each with the sampler of its lane as thread_sampler(),
+    // objects with a vectorised test override it.
+    virtual int intersectPacket(RayPacket &p, float tmin, int mask) {
+        Sampler *outer = thread_sampler();
+        int hits = 0;
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            if (!(mask >> i & 1)) continue;
+            thread_sampler() = p.sampler[i];
+            if (intersect(*p.ray[i], *p.hit[i], tmin)) {
+                p.sync(i);
+                hits |= 1 << i;
+            }
+        }
+        thread_sampler() = outer;
+        return hits;
+    }
+
+    // Area light interface for next event estimation.
+    // Pick a point on the object seen from p with the 2d sample u: the unit direction and distance to it,
+    // and the pdf of the direction over solid angle. Returns false if the object can not be sampled.
+    // The objects that can be sampled record themselves in Hit::object when they are hit.
+    virtual bool sampleLight(const Vector3f &p, const Vector2f &u, Vector3f &dir, float &dist, float &pdf) {
+        return false;
+    }
+    // The solid angle pdf of sampleLight() choosing the direction of r (unit) from its origin,
+    // t is where r hits the object. Returns 0 if r misses it.
+    virtual float lightPdf(const Ray &r, float &t) { return 0; }
+
+    Material *getMaterial() const { return material; }
 protected:
 
     Material *material;
@@ -0,0 +1,106 @@
+/**
+ * Packets of 4 rays traced together
+ * used for the camera rays, which start at the same point and go in nearly the same direction, so they
+ * mostly visit the same bvh nodes. the lanes are laid out as Float4 per component, a box or a primitive is
+ * tested against all the lanes at once. lanes are masked with the low 4 bits of an int, bit i is lane i
+*/
+#pragma once
+
+#include "simd.hpp"
+#include "ray.hpp"
+#include "hit.hpp"
+#include "bounding.hpp"
+
+class Sampler;
+
+constexpr int PACKET_SIZE = 4;
+constexpr int PACKET_ALL = (1 << PACKET_SIZE) - 1;
+
+struct RayPacket {
+    const Ray *ray[PACKET_SIZE];
+    Hit *hit[PACKET_SIZE];          // the closest hit of each lane, updated by the intersections
+    Sampler *sampler[PACKET_SIZE] = {};     // of the path of each lane, for the objects that sample (media)
+    Float4 ox, oy, oz;
+    Float4 dx, dy, dz;
+    Float4 inv_dx, inv_dy, inv_dz;
+    Float4 neg_x, neg_y, neg_z;     // masks of the lanes going to the negative side, Ray::sign
+    Float4 t;                       // hit[i]->t in lane i, kept in sync by whoever sets a hit
+
+    // n rays of rays[] with their hits, the lanes past n repeat the first ray and are never active
+    RayPacket(const Ray *rays, Hit *hits, int n = PACKET_SIZE) {
+        const Ray *r[PACKET_SIZE];
+        Hit *h[PACKET_SIZE];
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            int k = i < n ? i : 0;
+            r[i] = &rays[k];
+            h[i] = &hits[k];
+        }
+        set(r, h);
+    }
+
+    // the hits of other seen through other rays, one per lane, e.g. in the space of a transformed object
+    RayPacket(const Ray *rays, const RayPacket &other) {
+        const Ray *r[PACKET_SIZE];
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            r[i] = &rays[i];
+            sampler[i] = other.sampler[i];
+        }
+        set(r, other.hit);
+    }
+
+    // record a hit found on one lane by the scalar code
+    void sync(int lane) {
+        t[lane] = hit[lane]->t;
+    }
+
+    // AABB::intersect on the lanes of mask, the lanes that overlap the box within [tmin, t] are returned
+    // and t_enter holds their entry distance. the operations are the scalar ones lane by lane
+    int intersect(const AABB &box, float tmin, int mask, Float4 &t_enter) const {
+        Float4 lo_x(box.min.x()), lo_y(box.min.y()), lo_z(box.min.z());
+        Float4 hi_x(box.max.x()), hi_y(box.max.y()), hi_z(box.max.z());
+        Float4 t0 = (select(neg_x, hi_x, lo_x) - ox) * inv_dx;
+        Float4 t1 = (select(neg_x, lo_x, hi_x) - ox) * inv_dx;
+        Float4 ty0 = (select(neg_y, hi_y, lo_y) - oy) * inv_dy;
+        Float4 ty1 = (select(neg_y, lo_y, hi_y) - oy) * inv_dy;
+        Float4 tz0 = (select(neg_z, hi_z, lo_z) - oz) * inv_dz;
+        Float4 tz1 = (select(neg_z, lo_z, hi_z) - oz) * inv_dz;
+
+        // a NaN bound leaves the interval unchanged, as in the scalar test
+        Float4 near(tmin), far = t;
+        near = select(t0 > near, t0, near);
+        near = select(ty0 > near, ty0, near);
+        near = select(tz0 > near, tz0, near);
+        far = select(t1 < far, t1, far);
+        far = select(ty1 < far, ty1, far);
+        far = select(tz1 < far, tz1, far);
+        t_enter = near;
+        return mask & ~movemask(near > far);
+    }
+
+    // the lanes of mask whose entry distance is not behind their closest hit
+    int alive(const Float4 &t_enter, int mask) const {
+        return mask & ~movemask(t_enter > t);
+    }
+
+private:
+    void set(const Ray *const *rays, Hit *const *hits) {
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            const Ray &r = *rays[i];
+            ray[i] = &r;
+            hit[i] = hits[i];
+            ox[i] = r.origin.x(); oy[i] = r.origin.y(); oz[i] = r.origin.z();
+            dx[i] = r.direction.x(); dy[i] = r.direction.y(); dz[i] = r.direction.z();
+            inv_dx[i] = r.inv_direction.x(); inv_dy[i] = r.inv_direction.y(); inv_dz[i] = r.inv_direction.z();
+            t[i] = hits[i]->t;
+        }
+        neg_x = Float4::fromBits(rays_sign(0));
+        neg_y = Float4::fromBits(rays_sign(1));
+        neg_z = Float4::fromBits(rays_sign(2));
+    }
+
+    int rays_sign(int axis) const {
+        int bits = 0;
+        for (int i = 0; i < PACKET_SIZE; i++) bits |= ray[i]->sign[axis] << i;
+        return bits;
+    }
+};
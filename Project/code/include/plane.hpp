@@ -46,6 +46,22 @@ public:
         return false;
     }
 
+    // intersect on the lanes of a packet, with the same operations
+    int intersectPacket(RayPacket &p, float tmin, int mask) override {
+        Float4 nx(_n.x()), ny(_n.y()), nz(_n.z());
+        Float4 n_dot_rd = nx * p.dx + ny * p.dy + nz * p.dz;
+        // fabs(n_dot_rd) < 1e-6 compares in double, in float that is <= 1e-6f
+        Float4 t = (Float4(_d) - (nx * p.ox + ny * p.oy + nz * p.oz)) / n_dot_rd;
+        Float4 miss = (abs(n_dot_rd) <= Float4(1e-6f)) | (t < Float4(tmin)) | (t <= Float4(0.0f));
+        int hits = mask & ~movemask(miss) & movemask(t <= p.t);
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            if (!(hits >> i & 1)) continue;
+            p.hit[i]->set(t[i], material, _n);
+            p.sync(i);
+        }
+        return hits;
+    }
+
     bool bounding_box(double _time0, double _time1, AABB &output_box) override {
         // bounding box of a plane
         printf("Plane does not have bounding box\n");
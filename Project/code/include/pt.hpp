@@ -5,14 +5,23 @@
 
 #include <vector>
 #include <string>
+#include <unordered_set>
+#include <atomic>
+#include <climits>
+#include <cfloat>
 #include <omp.h>
 
 #include "renderer.hpp"
-#include "image.hpp"
+#include "film.hpp"
+#include "checkpoint.hpp"
 #include "camera.hpp"
 #include "ray.hpp"
 #include "group.hpp"
 #include "hit.hpp"
+#include "rand.hpp"
+#include "sampling.hpp"
+#include "sampler.hpp"
+#include "packet.hpp"
 
 
 
@@ -22,36 +31,57 @@ public:
     // come from the scene parser, for convenience
     Camera *camera;     // the camera of the scene
     Group *group;       // the group of objects in the scene
+    std::vector<Object3D*> emitters;    // area lights for next event estimation
+    std::unordered_set<const Object3D *> emitter_set;  // the same, to look up the Hit::object of a path
 
     // new variables created or needed to store the data
-    Image *image;       // image created, to be written to output file
+    Film *film;         // samples of the render, the image written to output file is their mean
+    CheckpointWriter checkpoints;   // saves the images of the passes in the background
 
     // parameters
     int rounds;         // number of rounds of path tracing for each pixel
-    int max_depth;      // max depth of the path tracing
-    int step;           // step of saving the image
+    int max_depth;      // max depth of the path tracing, only a safety cap with russian roulette
+    int rr_depth = 3;   // bounces before russian roulette starts, a negative value turns it off
+    int step;           // step of saving the image, a checkpoint every step rounds
+    int seed;           // seed of the random numbers, the same seed gives the same image
+    bool nee;           // sample the emitters at diffuse bounces, combined with the bsdf samples by mis
+    int aovs = 0;       // Film::AOV_* planes kept and saved next to the image
+    bool use_packets = true;    // intersect the camera rays of a pixel in packets, the bounces go one by one
+    Sampler::Type sampler_type = Sampler::SOBOL;  // of the camera and scattering numbers, see sampler.hpp
+
+    // adaptive sampling, on when max_rounds > rounds or with a time budget. every pixel first takes rounds
+    // samples, then passes of rounds more samples go to the pixels whose relative error is above threshold
+    float threshold = 0.02f;    // relative standard error of the mean luminance where a pixel stops
+    int max_rounds = 0;         // samples of a pixel at most, 0 for no limit but the time budget
+    double time_budget = 0;     // seconds, no new pass or tile is started after it, the first pass always ends
 
     // attributes
     int width, height;  // width and height of the image
+    std::atomic<long long> num_rays;    // rays cast by the last render, camera, bounce and shadow rays
 
-    PathTracing(SceneParser *scene, std::string output_file, int rounds=100, int max_depth=10, int step=20
-
+    PathTracing(SceneParser *scene, std::string output_file, int rounds=100, int max_depth=10, int step=20,
+        int seed=0, bool nee=true
     ) : Renderer(scene, output_file) {
         camera = scene->getCamera();
         group = scene->getGroup();
+        emitters = scene->getEmitters();
+        emitter_set.insert(emitters.begin(), emitters.end());
         width = camera->getWidth();
         height = camera->getHeight();
-        image = new Image(width, height);
+        film = new Film(width, height);
 
         this->rounds = rounds;
         this->max_depth = max_depth;
         this->step = step;
+        this->seed = seed;
+        this->nee = nee && !emitters.empty();
+        num_rays = 0;
 
-        fprintf(stderr, "PathTracing: %d rounds, %d max_depth\n", rounds, max_depth);
+        fprintf(stderr, "PathTracing: %d rounds, %d max_depth, %d emitters\n", rounds, max_depth, (int)emitters.size());
     }
 
     ~PathTracing() {
-        delete image;
+        delete film;
     }
 
     static inline float rand_bias() {
@@ -65,51 +95,239 @@ public:
     }
 
     void render() {
-        // timer
-        clock_t start, end;
-        start = time(NULL);
-
-#pragma omp parallel for schedule(dynamic, 1)
-        for (int i = 0; i < width; i++) {
-            if (i == 0) {
-                int num = omp_get_num_threads();
-                fprintf(stderr, "Number of threads: %d\n", num);
+        int num = omp_get_max_threads();
+        fprintf(stderr, "Number of threads: %d\n", num);
+
+        renderImage();
+        printf("\n");
+        save();
+    }
+
+    // fill the film without saving the image. with step < rounds the samples go in passes of step rounds
+    // and a checkpoint is saved after each pass but the last, by a background thread during the next pass
+    virtual void renderImage(bool show_progress = true) {
+        num_rays = 0;
+        if (max_rounds > rounds || time_budget > 0) {
+            film->reset(aovs | Film::AOV_VARIANCE);
+            renderAdaptive(show_progress);
+            return;
+        }
+        film->reset(aovs);
+        int pass_rounds = step > 0 && step < rounds ? step : rounds;
+        std::vector<PCG32> gens(pass_rounds < rounds ? width * height : 0);
+        for (int done = 0; done < rounds; done += pass_rounds) {
+            int n = std::min(pass_rounds, rounds - done);
+            renderTiles(width, height, [&](const Tile &tile) {
+                long long rays = 0;
+                for (int j = tile.y0; j < tile.y1; j++) {
+                    for (int i = tile.x0; i < tile.x1; i++) {
+                        // one random stream per pixel, going on from where the last pass left it
+                        int p = j * width + i;
+                        if (done == 0) {
+                            seed_pixel(rand_generator(), seed, 0, p);
+                        } else {
+                            rand_generator() = gens[p];
+                        }
+                        samplePixel(i, j, n, &rays);
+                        if (!gens.empty()) gens[p] = rand_generator();
+                    }
+                }
+                num_rays += rays;
+            }, show_progress);
+            if (done + n < rounds) {
+                checkpoints.save(*film, outputName(std::to_string(done + n)));
+            }
+        }
+        checkpoints.wait();
+    }
+
+    // russian roulette after the bounce at depth, a path goes on with the probability of its throughput
+    // luminance, at most 0.95, and the survivors are scaled up by it so the estimate stays unbiased
+    bool survive(Vector3f &cf, int depth) const {
+        if (rr_depth < 0 || depth < rr_depth) {
+            return true;
+        }
+        float p = fmin(luminance(cf), 0.95f);
+        if (!(p > 0) || RAND_UNIFORM >= p) {
+            return false;
+        }
+        cf = cf / p;
+        return true;
+    }
+
+    // albedo and normal of the first hit of a path, for the aovs
+    struct PathFeatures {
+        Vector3f albedo = Vector3f::ZERO;
+        Vector3f normal = Vector3f::ZERO;
+    };
+
+    // n samples of pixel (i, j) with the random generator of the thread, added to the film.
+    // the samples are numbered on from the ones already in the film
+    void samplePixel(int i, int j, int n, long long *rays=nullptr) {
+        int p = j * width + i;
+        int first = film->samples(p);
+        bool features = film->getAOVs() & (Film::AOV_ALBEDO | Film::AOV_NORMAL);
+        Vector3f samples[PACKET_SIZE];
+        PathFeatures feats[PACKET_SIZE];
+        int k = 0;
+        for (; use_packets && k + PACKET_SIZE <= n; k += PACKET_SIZE) {
+            tracePacket(i, j, first + k, samples, rays, features ? feats : nullptr);
+            for (int s = 0; s < PACKET_SIZE; s++) {
+                film->addSample(p, samples[s]);
+                if (features) film->addFeatures(p, feats[s].albedo, feats[s].normal);
+            }
+        }
+        for (; k < n; k++) {
+            Sampler sampler = pixelSampler(i, j, first + k);
+            Ray ray = cameraRay(i, j, sampler);
+            Vector3f sample = traceRay(ray, 0, rays, nullptr, &sampler, features ? feats : nullptr);
+            film->addSample(p, sample);
+            if (features) film->addFeatures(p, feats[0].albedo, feats[0].normal);
+        }
+    }
+
+    // the passes of adaptive sampling, a pixel keeps its random stream from one pass to the next.
+    // a pixel goes on while its error or the error of a neighbour is above the threshold: a pixel that
+    // only saw black samples so far has no variance, but next to noisy pixels it is likely not converged.
+    // a checkpoint is saved after a pass but the last once step more samples per pixel went in on average.
+    // the film must keep the variance
+    void renderAdaptive(bool show_progress) {
+        double start = omp_get_wtime();
+        int cap = max_rounds > 0 ? max_rounds : INT_MAX;
+        auto out_of_time = [&]() {
+            return time_budget > 0 && omp_get_wtime() - start > time_budget;
+        };
+        std::vector<PCG32> gens(width * height);   // where the random stream of each pixel stopped
+        std::vector<float> error(width * height);
+        std::vector<char> active(width * height, 1);
+        long long num_active = (long long)width * height;
+        long long total = 0;    // samples in the film
+        long long saved = 0;    // samples per pixel of the last checkpoint
+        int pass = 0;
+        for (; num_active > 0 && (pass == 0 || !out_of_time()); pass++) {
+            renderTiles(width, height, [&](const Tile &tile) {
+                if (pass > 0 && out_of_time()) return;
+                long long rays = 0;
+                for (int j = tile.y0; j < tile.y1; j++) {
+                    for (int i = tile.x0; i < tile.x1; i++) {
+                        int p = j * width + i;
+                        if (!active[p]) continue;
+                        if (pass == 0) {
+                            seed_pixel(rand_generator(), seed, 0, p);
+                        } else {
+                            rand_generator() = gens[p];
+                        }
+                        samplePixel(i, j, std::min(rounds, cap - film->samples(p)), &rays);
+                        gens[p] = rand_generator();
+                    }
+                }
+                num_rays += rays;
+            }, show_progress && pass == 0);
+
+            for (int p = 0; p < width * height; p++) {
+                error[p] = film->relativeError(p);
             }
-            float ratio = (float)(i + 0.0001) / (width);
-            // approximate time
-            end = time(NULL);
-            float time = (float)(end - start) / 60;
-            float time_left = time / ratio - time;
-            fprintf(stderr, "\rProgress: %.2f%%, Time: %.2fmin, Time left: %.2fmin", ratio * 100, time, time_left);
-            fflush(stderr);
+            num_active = 0;
+            total = 0;
             for (int j = 0; j < height; j++) {
-                Vector3f color = Vector3f::ZERO;
-                for (int k = 0; k < rounds; k++) {
-                    Ray ray = camera->generateBlurRay(Vector2f(i + rand_bias(), j + rand_bias()));
-                    color += traceRay(ray, 0);  // init with color of black
+                for (int i = 0; i < width; i++) {
+                    float e = 0;
+                    for (int y = std::max(j - 1, 0); y <= std::min(j + 1, height - 1); y++) {
+                        for (int x = std::max(i - 1, 0); x <= std::min(i + 1, width - 1); x++) {
+                            e = fmax(e, error[y * width + x]);
+                        }
+                    }
+                    int p = j * width + i;
+                    active[p] = film->samples(p) < cap && e > threshold;
+                    num_active += active[p];
+                    total += film->samples(p);
                 }
-                color = color / rounds;
-                image->SetPixel(i, j, color);
+            }
+            if (show_progress) {
+                fprintf(stderr, "\nPass %d: %lld pixels above the threshold, %.1fs", pass, num_active, omp_get_wtime() - start);
+            }
+            long long spp = total / ((long long)width * height);
+            if (step > 0 && spp >= saved + step && num_active > 0 && !out_of_time()) {
+                checkpoints.save(*film, outputName(std::to_string(spp)));
+                saved = spp;
             }
         }
-        printf("\n");
-        save();
+        checkpoints.wait();
+
+        fprintf(stderr, "\nAdaptive sampling: %d passes, %.1f samples per pixel, %lld pixels above the threshold\n",
+                pass, (double)total / (width * height), num_active);
+    }
+
+    // the sampler of sample index of pixel (i, j)
+    Sampler pixelSampler(int i, int j, int index) const {
+        Sampler sampler(sampler_type);
+        sampler.startSample((uint64_t)j * width + i, index, seed);
+        return sampler;
+    }
+
+    // a camera ray through pixel (i, j), jittered by -1 ~ 1 pixels
+    Ray cameraRay(int i, int j, Sampler &sampler) {
+        Vector2f jitter = sampler.get2D();
+        return camera->generateBlurRay(Vector2f(i + 2 * jitter.x() - 1, j + 2 * jitter.y() - 1), &sampler);
+    }
+
+    // PACKET_SIZE samples of pixel (i, j) from sample index first: the camera rays are intersected together,
+    // then each path goes on alone. the colors of the samples are written to colors, their first hits to
+    // features if given
+    void tracePacket(int i, int j, int first, Vector3f *colors, long long *rays=nullptr,
+                     PathFeatures *features=nullptr) {
+        Sampler samplers[PACKET_SIZE] = {
+            pixelSampler(i, j, first), pixelSampler(i, j, first + 1),
+            pixelSampler(i, j, first + 2), pixelSampler(i, j, first + 3)
+        };
+        Ray camera_rays[PACKET_SIZE] = {
+            cameraRay(i, j, samplers[0]), cameraRay(i, j, samplers[1]),
+            cameraRay(i, j, samplers[2]), cameraRay(i, j, samplers[3])
+        };
+        static_assert(PACKET_SIZE == 4, "one camera ray per lane");
+        Hit hits[PACKET_SIZE];
+        RayPacket packet(camera_rays, hits);
+        for (int k = 0; k < PACKET_SIZE; k++) {
+            packet.sampler[k] = &samplers[k];
+        }
+        if (rays) (*rays) += PACKET_SIZE;
+        group->intersectPacket(packet, 0.001, PACKET_ALL);
+        for (int k = 0; k < PACKET_SIZE; k++) {
+            colors[k] = traceRay(camera_rays[k], 0, rays, &hits[k], &samplers[k], features ? &features[k] : nullptr);
+        }
     }
-    
 
-    // traceRay: trace a ray for once
-    Vector3f traceRay(Ray ray, int depth) {
+    // traceRay: trace a ray for once, the number of rays cast is added to *rays.
+    // first_hit is the closest hit of ray if it was already intersected, without a material for a miss.
+    // sampler gives the numbers of the bounces, the generator of the thread if null.
+    // the first hit is written to features if given
+    Vector3f traceRay(Ray ray, int depth, long long *rays=nullptr, const Hit *first_hit=nullptr,
+                      Sampler *sampler=nullptr, PathFeatures *features=nullptr) {
+        if (features) *features = PathFeatures();
         Vector3f color = Vector3f::ZERO;
         Vector3f cf = Vector3f(1.0, 1.0, 1.0);
         Hit hit;
+        // solid angle pdf of the last bounce if it was diffuse, 0 for the camera ray and the other lobes
+        float bsdf_pdf = 0;
         
         // bool trace = false;
         while(true) {
-            if (++depth > max_depth || cf.x() < 1e-3 || cf.y() < 1e-3 || cf.z() < 1e-3) {
+            if (++depth > max_depth) {
                 break;
             }
-            hit = Hit();
-            if (group->intersect(ray, hit, 0.001)) {
+            bool found;
+            if (first_hit) {
+                hit = *first_hit;
+                found = hit.getMaterial() != nullptr;
+                first_hit = nullptr;
+            } else {
+                hit = Hit();
+                if (rays) (*rays)++;
+                thread_sampler() = sampler;
+                found = group->intersect(ray, hit, 0.001);
+                thread_sampler() = nullptr;
+            }
+            if (found) {
                 // printf("hit at point: %f %f %f\n", ray.pointAtParameter(hit.getT()).x(), ray.pointAtParameter(hit.getT()).y(), ray.pointAtParameter(hit.getT()).z());
                 // printf("T = %f\n", hit.getT());
                 // hit
@@ -119,15 +337,38 @@ public:
                 // check if entering the object
                 // note: the normal is always pointing outwards
                 bool front = Vector3f::dot(ray.getDirection(), hit.getNormal()) < 0;
-                if (hit.getMaterial()->scatter(ray, hit, attenuation, scattered, front)) {
-                    color += cf * hit.getMaterial()->selfColor;
+                bool diffuse = false;
+                Material *material = hit.getMaterial();
+                if (material->scatter(ray, hit, attenuation, scattered, front, &diffuse, sampler)) {
+                    if (material->selfColor.squaredLength() > 0) {
+                        color += cf * material->selfColor * emissionWeight(ray, hit, bsdf_pdf);
+                    }
+                    // media hits have no normal, they scatter in all directions and are left to the bsdf samples
+                    bool surface = hit.getNormal().squaredLength() > 0.5f;
+                    if (features) {
+                        features->albedo = attenuation;
+                        if (surface) features->normal = hit.getNormal().normalized();
+                        features = nullptr;
+                    }
+                    bsdf_pdf = 0;
+                    // the light sample is one bounce longer, so not at the last one
+                    if (nee && diffuse && surface && depth < max_depth) {
+                        // the diffuse lobe is cosine weighted, attenuation / pi is the brdf
+                        Vector3f n = hit.getNormal().normalized();
+                        color += cf * attenuation * sampleEmitters(scattered.getOrigin(), n, ray.time, rays, sampler) / M_PI;
+                        bsdf_pdf = Material::diffusePdf(n, scattered.getDirection());
+                    }
                     ray = scattered;
                     cf = cf * attenuation;
+                    if (!survive(cf, depth)) {
+                        break;
+                    }
                 } else {
                     break;
                 }
             } else {
                 // no hit
+                if (features) features->albedo = scene->getBackgroundColor();
                 color += cf * scene->getBackgroundColor();
                 break;
             }
@@ -136,6 +377,75 @@ public:
         return color;
     }
 
+    // one light sample from p on a surface with normal n: emission * cos / pdf with the mis weight.
+    // sampler gives the numbers, the generator of the thread if null
+    Vector3f sampleEmitters(const Vector3f &p, const Vector3f &n, double time, long long *rays=nullptr,
+                            Sampler *sampler=nullptr) {
+        Vector3f dir, radiance;
+        Object3D *emitter;
+        float dist;
+        if (!sampleEmitter(p, n, sampler, dir, emitter, dist, radiance) ||
+            !emitterVisible(Ray(p, dir, time), emitter, dist, rays, sampler)) {
+            return Vector3f::ZERO;
+        }
+        return radiance;
+    }
+
+    // pick an emitter and a direction to it with 3 dimensions of sampler, radiance is what arrives if
+    // emitterVisible() agrees
+    bool sampleEmitter(const Vector3f &p, const Vector3f &n, Sampler *sampler, Vector3f &dir, Object3D *&emitter,
+                       float &dist, Vector3f &radiance) {
+        if (!sampler) sampler = &independent_sampler();
+        int count = emitters.size();
+        int index = std::min((int)(sampler->get1D() * count), count - 1);
+        emitter = emitters[index];
+        float pdf;
+        if (!emitter->sampleLight(p, sampler->get2D(), dir, dist, pdf) || pdf <= 0) {
+            return false;
+        }
+        float cos = Vector3f::dot(n, dir);
+        if (cos <= 0) {
+            return false;
+        }
+        pdf /= count;
+        float weight = power_heuristic(pdf, Material::diffusePdf(n, dir));
+        radiance = emitter->getMaterial()->selfColor * (cos * weight / pdf);
+        return true;
+    }
+
+    // the media on the way draw from sampler, see thread_sampler
+    bool emitterVisible(const Ray &shadow_ray, Object3D *emitter, float dist, long long *rays=nullptr,
+                        Sampler *sampler=nullptr) {
+        // find the emitter with its own intersection, so a shadow ray sees exactly what a path would.
+        // a relative epsilon on dist lets grazing occluders through.
+        // the sampled point must be the first one on the emitter, e.g. not on the back of a box
+        Hit light_hit;
+        if (!emitter->intersect(shadow_ray, light_hit, 0.001) || fabs(light_hit.getT() - dist) > 1e-3f * dist) {
+            return false;
+        }
+        // anything strictly before the emitter blocks it
+        if (rays) (*rays)++;
+        thread_sampler() = sampler;
+        bool blocked = group->occluded(shadow_ray, 0.001, light_hit.getT());
+        thread_sampler() = nullptr;
+        return !blocked;
+    }
+
+    // mis weight of emission found by a bsdf sample, the light sampling may have picked the same point
+    // if the object hit is one of the emitters
+    float emissionWeight(const Ray &ray, const Hit &hit, float bsdf_pdf) {
+        if (!nee || bsdf_pdf <= 0 || !emitter_set.count(hit.object)) {
+            return 1;
+        }
+        float t;
+        float light_pdf = hit.object->lightPdf(ray, t);
+        // the same point as the hit, not one the emitter hides behind it
+        if (!(light_pdf > 0) || fabs(t - hit.getT()) > 1e-5f * fmax(1.0f, hit.getT())) {
+            light_pdf = 0;
+        }
+        return power_heuristic(bsdf_pdf, light_pdf / emitters.size());
+    }
+
     // utils
     // get a direction inside the unit sphere
     Vector3f getRandDirInSphere() {
@@ -146,7 +456,16 @@ public:
         return dir;
     }
 
+    // output_file with _suffix before the extension, as a bmp
+    std::string outputName(const std::string &suffix) const {
+        return output_file.substr(0, output_file.find_last_of(".")) + "_" + suffix + ".bmp";
+    }
+
+    // the image and the aovs asked for
     void save(){
-        image->SaveBMP(output_file.c_str());
+        film->saveBMP(output_file.c_str());
+        if (aovs & Film::AOV_VARIANCE) film->saveBMP(outputName("variance").c_str(), Film::VARIANCE);
+        if (aovs & Film::AOV_ALBEDO) film->saveBMP(outputName("albedo").c_str(), Film::ALBEDO);
+        if (aovs & Film::AOV_NORMAL) film->saveBMP(outputName("normal").c_str(), Film::NORMAL);
     }
 };
\ No newline at end of file
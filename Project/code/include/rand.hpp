@@ -1,10 +1,71 @@
 #pragma once
-#include <random>
+#include <cstdint>
+#include <atomic>
 
-static std::mt19937 gen(0);
-static std::uniform_real_distribution<float> dis(0, 1);
+// PCG32 generator (M. O'Neill, pcg-random.org), 16 bytes of state.
+// seed picks the start point, stream picks one of 2^63 independent sequences
+class PCG32 {
+public:
+    explicit PCG32(uint64_t seed = 0, uint64_t stream = 0) {
+        set_seed(seed, stream);
+    }
 
-#define RAND_UNIFORM dis(gen)
+    void set_seed(uint64_t seed, uint64_t stream) {
+        state = 0;
+        inc = (stream << 1u) | 1u;
+        next();
+        state += seed;
+        next();
+    }
+
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+        uint32_t rot = (uint32_t)(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // 0 ~ 1, never 1
+    float uniform() {
+        return (next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+private:
+    uint64_t state;
+    uint64_t inc;
+};
+
+// splitmix64 finalizer, spreads nearby integers over all 64 bits.
+// generators that differ only in their stream are correlated, so mix the seed when they start together
+inline uint64_t mix_seed(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// one generator per thread, so the threads never share state.
+// each new thread starts on its own stream until it is seeded
+inline PCG32 &rand_generator() {
+    static std::atomic<uint64_t> next_stream(0);
+    static thread_local PCG32 gen(0, next_stream++);
+    return gen;
+}
+
+// reseed the generator of the calling thread, e.g. with the pixel index as stream,
+// so the image does not depend on which thread renders which pixel
+inline void rand_seed(uint64_t seed, uint64_t stream) {
+    rand_generator().set_seed(seed, stream);
+}
+
+// the generator of a pixel from the sample it starts at, for every renderer. the state is mixed from the
+// seed, the sample and the pixel, so neither neighbouring pixels nor the samples of a pixel start together
+inline void seed_pixel(PCG32 &gen, uint64_t seed, uint64_t sample, uint64_t pixel) {
+    gen.set_seed(mix_seed(mix_seed(mix_seed(seed) + sample) ^ pixel), pixel);
+}
+
+#define RAND_UNIFORM (rand_generator().uniform())
 #define RAND_UNIFORM_RANGE(a, b) (a + (b - a) * RAND_UNIFORM)
 #define RAND_SIGNED (2.0 * RAND_UNIFORM - 1.0)
-#define SMALL_POSI dis(gen) * 1e-6
\ No newline at end of file
+#define SMALL_POSI RAND_UNIFORM * 1e-6
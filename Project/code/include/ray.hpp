@@ -15,12 +15,21 @@ public:
         origin = orig;
         direction = dir;
         time = _time;
+        // for the slab test of the bounding boxes
+        inv_direction = Vector3f(1 / dir.x(), 1 / dir.y(), 1 / dir.z());
+        sign[0] = inv_direction.x() < 0;
+        sign[1] = inv_direction.y() < 0;
+        sign[2] = inv_direction.z() < 0;
     }
 
     Ray(const Ray &r) {
         origin = r.origin;
         direction = r.direction;
         time = r.time;
+        inv_direction = r.inv_direction;
+        sign[0] = r.sign[0];
+        sign[1] = r.sign[1];
+        sign[2] = r.sign[2];
     }
 
     const Vector3f &getOrigin() const {
@@ -31,6 +40,10 @@ public:
         return direction;
     }
 
+    const Vector3f &getInvDirection() const {
+        return inv_direction;
+    }
+
     const double &getTime() const {
         return time;
     }
@@ -44,6 +57,8 @@ public:
 public:
     Vector3f origin;
     Vector3f direction;
+    Vector3f inv_direction;     // 1 / direction, set with direction
+    int sign[3];                // 1 if the direction is negative on the axis
 };
 
 inline std::ostream &operator<<(std::ostream &os, const Ray &r) {
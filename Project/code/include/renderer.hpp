@@ -8,11 +8,20 @@
 #include <string>
 
 #include "scene_parser.hpp"
+#include "tile_scheduler.hpp"
 
 class Renderer {
 protected:
     const SceneParser *scene;
     std::string output_file;
+    int tile_size = 32;     // side of the square tiles handed to the threads
+
+    // render_tile(tile) is called once per tile, tiles are spread over the threads with work stealing
+    template <typename F>
+    void renderTiles(int width, int height, F render_tile, bool show_progress = true) {
+        TileScheduler scheduler(width, height, tile_size);
+        scheduler.run(render_tile, show_progress);
+    }
 
 public:
     Renderer(SceneParser *scene, std::string output_file) : scene(scene), output_file(output_file) {}
@@ -2,12 +2,15 @@
 #define REVSURFACE_HPP
 
 #include <tuple>
+#include <vector>
+#include <algorithm>
 #include <float.h>
 
 #include "object3d.hpp"
 #include "curve.hpp"
 #include "triangle.hpp"
 #include "bounding.hpp"
+#include "mesh.hpp"
 
 
 class RevSurface : public Object3D {
@@ -17,8 +20,38 @@ class RevSurface : public Object3D {
 
     float y_max, y_min;
 
-    int intersect_time = 0;
-    int box_intersect_time = 0;
+    // the profile sampled once at construction, a point of the curve between two samples is the cubic
+    // hermite of their points and tangents, so the newton iterations never call the curve
+    std::vector<CurvePoint> table;
+    float phi_lo, phi_hi, step;
+
+    // the shell hierarchy of the first guesses. the curve comes as bezier pieces, split by de casteljau
+    // until the hull of their controls in the (distance to the axis, y) plane is thin, and a piece is inside
+    // the hull of its controls. revolved, a shell is bounded by an annular cylinder, the distance and y
+    // range of its controls, and the hull of a leaf by the cone shell around its chord. a ray reaches few
+    // of the leaves, and newton's method runs on the phi range of each
+    struct Shell {
+        float y0, y1, rho0, rho1;   // the annular cylinder
+        int left, right;            // children, -1 for a leaf
+        float phi0, phi1;
+        float ax, ay;               // start of the chord, the first control
+        float dx, dy;               // unit direction of the chord
+        float len;                  // of the chord
+        float lo, hi;               // offsets of the controls from the chord
+        float side;                 // sign of x of the controls, 0 when they are on both sides of the axis
+    };
+    std::vector<Shell> shells;
+
+    // the part [t0, t1] of the ray in the cylinder of a leaf
+    struct Span {
+        float t0, t1;
+        int leaf;
+    };
+
+    // a point of the ray, how far across the curve it is and the phi of the curve there
+    struct Sample {
+        float side, t, phi;
+    };
 
 public:
     RevSurface(Curve *pCurve, Material* material) : pCurve(pCurve), Object3D(material) {
@@ -32,6 +65,8 @@ public:
         // skip checking for faster
         box = nullptr;
         set_bounding_box();
+        build_table();
+        build_shells();
     }
 
     bool bounding_box(double time0, double time1, AABB &output_box) override {
@@ -75,68 +110,84 @@ public:
         return newtonIterate(r, h, tmin);
     }
 
-    bool newtonIterate(const Ray &r, Hit &h, float tmin) {
-        // start from the hit point of the bounding box
-        // if hit, set t and h
-        // if the final t is smaller than tmin, return false
+    // the same solve, without filling in the hit
+    bool occluded(const Ray &r, float tmin, float tmax) override {
+        float t, theta, phi;
+        Vector3f n;
+        return newtonSolve(r, tmin, tmax, t, theta, phi, n) && t < tmax;
+    }
 
-        // use t to describe ray, theta and phi to describe the point on the curve
-        // theta for the angle around y axis, phi for the ratio in y (equal to use y as the parameter, which is param t in curve)
-        float theta, phi, t=1e10;
-        if (!box->intersect(r, t)) {
+    bool newtonIterate(const Ray &r, Hit &h, float tmin) {
+        float t, theta, phi;
+        Vector3f n;
+        if (!newtonSolve(r, tmin, h.getT(), t, theta, phi, n)) {
             return false;
         }
-        if (t < tmin || t > h.getT()) {
-            box_intersect_time++;
+        h.set(t, material, n.normalized(), theta/2/M_PI, phi);
+        return true;
+    }
+
+    // finds t in [tmin, tmax] with the surface parameters theta, phi and the unnormalized normal n
+    bool newtonSolve(const Ray &r, float tmin, float tmax, float &t, float &theta, float &phi, Vector3f &n) const {
+        float t_enter, t_exit;
+        if (!box->intersect(r, tmin, tmax, t_enter, t_exit)) {
             return false;
         }
-        Vector3f p = r.pointAtParameter(t);
-        theta = atan2(-p.z(), p.x()) + M_PI;
-        phi = (y_max - p.y()) / (y_max - y_min);
-        // printf("init theta: %f, phi: %f\n", theta, phi);
+        // the leaves the ray passes, in the order it enters them. once a root is found, only the leaves
+        // entered before it can hold a nearer one
+        Span spans[MAX_SPANS];
+        int num_spans = shellSpans(r, t_enter, t_exit, spans);
+        std::sort(spans, spans + num_spans, [](const Span &a, const Span &b) { return a.t0 < b.t0; });
+        bool found = false;
+        for (int i = 0; i < num_spans && spans[i].t0 <= tmax; i++) {
+            const Shell &s = shells[spans[i].leaf];
+            float tt, ph;
+            if (!seed(r, s, spans[i], tt, ph)) {
+                continue;
+            }
+            Vector3f p = r.pointAtParameter(tt);
+            float side = s.side != 0 ? s.side : curvePoint((s.phi0 + s.phi1) / 2).V.x() < 0 ? -1 : 1;
+            // theta of the profile, the one of a profile at x < 0 is half a turn from the point
+            float th = side > 0 ? atan2(-p.z(), p.x()) : atan2(p.z(), -p.x());
+            Vector3f nn;
+            if (newtonConverge(r, tmin, tmax, s.phi0, s.phi1, tt, th, ph, nn)) {
+                t = tt; theta = th; phi = ph; n = nn;
+                tmax = tt;
+                found = true;
+            }
+        }
+        return found;
+    }
 
-        // use newton's method to find the intersection
-        Vector3f dphi, dtheta;
+    // newton's method from the guess in t, theta, phi, with phi kept in [phi0, phi1]
+    bool newtonConverge(const Ray &r, float tmin, float tmax, float phi0, float phi1, float &t, float &theta, float &phi,
+                        Vector3f &n) const {
+        // use t to describe ray, theta and phi to describe the point on the curve
+        // theta for the angle around y axis, phi for the parameter of the curve
+        Vector3f p, dphi, dtheta;
         for (int i=0; i < MAX_ITER; i++) {
-            phi = phi <= 0 ? 1e-5 : phi;
-            phi = phi >= 1 ? 1 - 1e-5 : phi;
-            // printf("phi: %f\n", phi);
+            phi = fmin(fmax(phi, phi0), phi1);
             theta = theta < 0 ? theta + 2 * M_PI : theta;
             theta = theta >= 2 * M_PI ? fmod(theta, 2 * M_PI) : theta;
             // get the point on the curve
-            // printf("get curve point\n");
-            CurvePoint cp = pCurve->getPoint(phi);
-            // printf("got curve point\n");
-            // to rotate the point and normal according to theta
-            Quat4f rot; rot.setAxisAngle(theta, Vector3f(0, 1, 0));
-            // Matrix3f rot_mat = Matrix3f::rotation(Vector3f(0, 1, 0), theta);
-            Matrix3f rot_mat = Matrix3f::rotation(rot);
-            // rotate the point and normal
-            p = rot_mat * cp.V;
-            dphi = rot_mat * cp.T;
-            dtheta = Vector3f(-cp.V.x() * sin(theta), 0, -cp.V.x() * cos(theta));
+            CurvePoint cp = curvePoint(phi);
+            // rotate the point and the tangent by theta around y, the profile is on the xy plane
+            float sin_theta = sin(theta), cos_theta = cos(theta);
+            p = Vector3f(cp.V.x() * cos_theta, cp.V.y(), -cp.V.x() * sin_theta);
+            dphi = Vector3f(cp.T.x() * cos_theta, cp.T.y(), -cp.T.x() * sin_theta);
+            dtheta = Vector3f(-cp.V.x() * sin_theta, 0, -cp.V.x() * cos_theta);
             // normal is vertical to the tangent plane
-            Vector3f n = Vector3f::cross(dphi, dtheta);
-            
+            n = Vector3f::cross(dphi, dtheta);
+
             // note that different from P107, S(u,v) - C(t), so the final update are reversed
             Vector3f dis = r.pointAtParameter(t) - p;
             float f = dis.squaredLength();
-            // printf("f: %f\n", f);
 
-            // distance smaller than epsilon, return true
+            // distance smaller than epsilon, newton's method converge
             if (f < EPSILON) {
-                // printf("revsurface intersect true\n");
-                // newton's method converge
                 // TODO check normal
-                if (t < tmin || t > h.getT() || phi < pCurve->lowerBound() || phi > pCurve->upperBound()) {
-                    // the final t is smaller than tmin, return false
-                    // or further than the previous hit point
-                    // printf("revsurface intersect false\n");
-                    return false;
-                }
-                // set  h
-                h.set(t, material, n.normalized(), theta/2/M_PI, phi);
-                return true;
+                // the final t is smaller than tmin, or further than the previous hit point
+                return t >= tmin && t <= tmax;
             }
 
             // P107 method, get D
@@ -149,8 +200,469 @@ public:
         return false;   // newton's method not converge
     }
 
-    constexpr static int MAX_ITER = 20;
-    constexpr static float EPSILON = 0.0001;
+    // the point and the tangent of the profile at phi, from the table
+    CurvePoint curvePoint(float phi) const {
+        float u = (phi - phi_lo) / step;
+        int i = std::min(std::max((int)u, 0), TABLE_SIZE - 1);
+        float s = u - i, s2 = s * s, s3 = s2 * s;
+        const CurvePoint &a = table[i], &b = table[i + 1];
+        CurvePoint cp;
+        cp.V = (2 * s3 - 3 * s2 + 1) * a.V + (3 * s2 - 2 * s3) * b.V + ((s3 - 2 * s2 + s) * step) * a.T + ((s3 - s2) * step) * b.T;
+        cp.T = ((6 * s2 - 6 * s) / step) * (a.V - b.V) + (3 * s2 - 4 * s + 1) * a.T + (3 * s2 - 2 * s) * b.T;
+        return cp;
+    }
+
+    // the surface as a triangle mesh, nowhere farther than tolerance from it. the profile is split until
+    // its chords stay within tolerance of the curve, so the rings are dense where it bends. every ring has
+    // the same segments, enough for the widest circle, so the rings meet without cracks. the normals are
+    // the ones of the surface and the texture coordinates the theta / 2pi and phi of its hits
+    Mesh *tessellate(float tolerance, const BVHConfig &config = BVHConfig()) const {
+        std::vector<float> phis;
+        for (int i = 0; i < TESS_START; i++) {
+            subdivide(phi_lo + (phi_hi - phi_lo) * i / TESS_START, phi_lo + (phi_hi - phi_lo) * (i + 1) / TESS_START,
+                      tolerance, 0, phis);
+        }
+        phis.push_back(phi_hi);
+
+        std::vector<CurvePoint> rings(phis.size());
+        float radius = 0, side = 0;
+        for (int i = 0; i < (int) phis.size(); i++) {
+            rings[i] = pCurve->getPoint(phis[i]);
+            radius = fmax(radius, fabs(rings[i].V.x()));
+            side += rings[i].V.x();
+        }
+        side = side < 0 ? -1 : 1;
+        // the sagitta of a segment of the widest circle within tolerance
+        int segments = tolerance < radius ? (int) ceil(M_PI / acos(1 - tolerance / radius)) : 8;
+        segments = std::min(std::max(segments, 8), 4096);
+
+        std::vector<Vector3f> vertices, normals;
+        std::vector<Vector2f> uvs;
+        for (int i = 0; i < (int) rings.size(); i++) {
+            Vector3f V = rings[i].V, T = rings[i].T;
+            // a zero tangent where control points repeat, the chord to the next rings instead
+            if (T.squaredLength() < 1e-12f) {
+                T = rings[std::min(i + 1, (int) rings.size() - 1)].V - rings[std::max(i - 1, 0)].V;
+            }
+            float s = V.x() > 0 ? 1 : V.x() < 0 ? -1 : side;
+            for (int j = 0; j <= segments; j++) {
+                float theta = 2 * M_PI * j / segments;
+                float sin_theta = sin(theta), cos_theta = cos(theta);
+                vertices.push_back(Vector3f(V.x() * cos_theta, V.y(), -V.x() * sin_theta));
+                // cross(dphi, dtheta) over |x|
+                normals.push_back((s * Vector3f(-T.y() * cos_theta, T.x(), T.y() * sin_theta)).normalized());
+                uvs.push_back(Vector2f((float) j / segments, phis[i]));
+            }
+        }
+
+        std::vector<Mesh::TriangleIndex> triangles;
+        auto add = [&](int a, int b, int c) {
+            Vector3f e = Vector3f::cross(vertices[b] - vertices[a], vertices[c] - vertices[a]);
+            if (e.squaredLength() < 1e-20f) return;     // on the axis
+            // counterclockwise around the normal
+            if (Vector3f::dot(e, normals[a] + normals[b] + normals[c]) < 0) std::swap(b, c);
+            triangles.push_back(Mesh::TriangleIndex(a, b, c));
+        };
+        for (int i = 0; i + 1 < (int) rings.size(); i++) {
+            for (int j = 0; j < segments; j++) {
+                int a = i * (segments + 1) + j, c = a + segments + 1;
+                add(a, c, a + 1);
+                add(a + 1, c, c + 1);
+            }
+        }
+        return new Mesh(vertices, normals, uvs, triangles, material, config);
+    }
+
+    constexpr static int MAX_ITER = 10;     // per leaf
+    constexpr static int TABLE_SIZE = 256;
+    constexpr static int SHELL_DEPTH = 6;   // splits of a bezier piece at most
+    constexpr static float SHELL_WIDTH = 0.01;  // of a leaf at most, over the size of the profile
+    constexpr static int MAX_SPANS = 64;
+    constexpr static int SIDE_ITER = 2;     // for the place of a point along the chord of a leaf
+    constexpr static float GRAZE = 0.1;     // of the width of a leaf, a ray this near the curve may touch it
+    constexpr static float ON_CURVE = 0.01; // of the width of a leaf, a ray this near the curve starts on it
+    constexpr static float EPSILON = 0.000001;
+    constexpr static int TESS_START = 16;   // spans of the profile before the adaptive split
+    constexpr static int TESS_DEPTH = 12;   // splits of a span at most
+
+private:
+    // appends the start of [a, b] to phis, split in two while the chord is farther than tolerance from
+    // the curve at a quarter, the half or three quarters
+    void subdivide(float a, float b, float tolerance, int depth, std::vector<float> &phis) const {
+        Vector3f va = pCurve->getPoint(a).V, vb = pCurve->getPoint(b).V;
+        Vector3f chord = vb - va;
+        float len2 = chord.squaredLength();
+        bool flat = true;
+        for (int k = 1; k < 4 && flat; k++) {
+            Vector3f q = pCurve->getPoint(a + (b - a) * k / 4).V - va;
+            float u = len2 > 0 ? fmin(fmax(Vector3f::dot(q, chord) / len2, 0.0f), 1.0f) : 0;
+            flat = (q - u * chord).length() <= tolerance;
+        }
+        if (flat || depth >= TESS_DEPTH) {
+            phis.push_back(a);
+            return;
+        }
+        float m = (a + b) / 2;
+        subdivide(a, m, tolerance, depth + 1, phis);
+        subdivide(m, b, tolerance, depth + 1, phis);
+    }
+
+    void build_table() {
+        phi_lo = pCurve->lowerBound();
+        phi_hi = pCurve->upperBound();
+        step = (phi_hi - phi_lo) / TABLE_SIZE;
+        table.resize(TABLE_SIZE + 1);
+        for (int i = 0; i <= TABLE_SIZE; i++) {
+            table[i] = pCurve->getPoint(i < TABLE_SIZE ? phi_lo + i * step : phi_hi);
+        }
+    }
+
+    void build_shells() {
+        std::vector<BezierPiece> pieces = pCurve->bezierPieces();
+        float scale = 0;
+        for (const BezierPiece &piece : pieces) {
+            for (const Vector3f &c : piece.controls) {
+                scale = fmax(scale, fmax(fabs(c.x()), fabs(c.y())));
+            }
+        }
+        shells.clear();
+        build_pieces(pieces, 0, pieces.size(), SHELL_WIDTH * scale);
+    }
+
+    // the shell of the pieces [begin, end), returns its index
+    int build_pieces(const std::vector<BezierPiece> &pieces, int begin, int end, float width) {
+        if (end - begin == 1) {
+            return build_bezier(pieces[begin].controls, pieces[begin].phi0, pieces[begin].phi1, width, 0);
+        }
+        int node = shells.size();
+        shells.push_back(Shell());
+        int mid = (begin + end) / 2;
+        int left = build_pieces(pieces, begin, mid, width);
+        int right = build_pieces(pieces, mid, end, width);
+        Shell s = shells[left];
+        const Shell &b = shells[right];
+        s.y0 = fmin(s.y0, b.y0); s.y1 = fmax(s.y1, b.y1);
+        s.rho0 = fmin(s.rho0, b.rho0); s.rho1 = fmax(s.rho1, b.rho1);
+        s.phi1 = b.phi1;
+        s.left = left;
+        s.right = right;
+        shells[node] = s;
+        return node;
+    }
+
+    // the shell of the bezier of controls c over [phi0, phi1], split at the half until its hull is
+    // narrower than width
+    int build_bezier(const std::vector<Vector3f> &c, float phi0, float phi1, float width, int depth) {
+        int node = shells.size();
+        shells.push_back(Shell());
+        int m = c.size() - 1;
+        Shell s;
+        s.phi0 = phi0; s.phi1 = phi1;
+        s.left = s.right = -1;
+        bool positive = false, negative = false;
+        s.y0 = s.rho0 = FLT_MAX;
+        s.y1 = s.rho1 = -FLT_MAX;
+        for (const Vector3f &q : c) {
+            positive |= q.x() > 0;
+            negative |= q.x() < 0;
+            s.y0 = fmin(s.y0, q.y()); s.y1 = fmax(s.y1, q.y());
+            s.rho0 = fmin(s.rho0, fabs(q.x())); s.rho1 = fmax(s.rho1, fabs(q.x()));
+        }
+        s.side = positive && negative ? 0 : negative ? -1 : 1;
+        if (s.side == 0) {
+            s.rho0 = 0;     // the piece crosses the axis
+        }
+        // the chord from the first control to the last, to the farthest one when the ends meet
+        s.ax = fabs(c[0].x()); s.ay = c[0].y();
+        int end = m;
+        float far = 0;
+        for (int i = 1; i <= m; i++) {
+            float ex = fabs(c[i].x()) - s.ax, ey = c[i].y() - s.ay;
+            if (ex * ex + ey * ey > far) {
+                far = ex * ex + ey * ey;
+                end = i;
+            }
+        }
+        float last_x = fabs(c[m].x()) - s.ax, last_y = c[m].y() - s.ay;
+        if (last_x * last_x + last_y * last_y > 1e-12f) {
+            end = m;
+        }
+        float ex = fabs(c[end].x()) - s.ax, ey = c[end].y() - s.ay;
+        s.len = sqrt(ex * ex + ey * ey);
+        s.dx = s.len > 0 ? ex / s.len : 0;
+        s.dy = s.len > 0 ? ey / s.len : 1;
+        // the curve of a leaf goes one way along its chord when the controls do
+        s.lo = FLT_MAX;
+        s.hi = -FLT_MAX;
+        bool monotone = true;
+        float prev = 0;
+        for (const Vector3f &q : c) {
+            float qx = fabs(q.x()) - s.ax, qy = q.y() - s.ay;
+            float offset = qx * s.dy - qy * s.dx, along = qx * s.dx + qy * s.dy;
+            s.lo = fmin(s.lo, offset); s.hi = fmax(s.hi, offset);
+            monotone &= along >= prev - 1e-6f;
+            prev = along;
+        }
+        if (depth < SHELL_DEPTH && (s.side == 0 || s.hi - s.lo > width || !monotone)) {
+            // de casteljau at the half, the first and the last point of each level
+            std::vector<Vector3f> left(m + 1), right(m + 1), q = c;
+            for (int r = 0; r <= m; r++) {
+                left[r] = q[0];
+                right[m - r] = q[m - r];
+                for (int j = 0; j < m - r; j++) {
+                    q[j] = (q[j] + q[j + 1]) / 2;
+                }
+            }
+            float mid = (phi0 + phi1) / 2;
+            s.left = build_bezier(left, phi0, mid, width, depth + 1);
+            s.right = build_bezier(right, mid, phi1, width, depth + 1);
+        }
+        // padded, a flat piece still has a hull the ray is in for a while
+        float pad = width * 0.01f;
+        s.y0 -= pad; s.y1 += pad;
+        s.rho0 = fmax(s.rho0 - pad, 0.0f); s.rho1 += pad;
+        s.lo -= pad; s.hi += pad;
+        shells[node] = s;
+        return node;
+    }
+
+    // the spans of the leaves whose cylinders the ray passes in [tmin, tmax]. when there are too many,
+    // the ones entered last are dropped
+    int shellSpans(const Ray &r, float tmin, float tmax, Span *spans) const {
+        const Vector3f &o = r.getOrigin(), &d = r.getDirection();
+        // the squared distance to the axis along the ray, a2 t^2 + a1 t + a0
+        double a2 = d.x() * d.x() + d.z() * d.z();
+        double a1 = 2 * (o.x() * d.x() + o.z() * d.z());
+        double a0 = o.x() * o.x() + o.z() * o.z();
+        if (a2 < 1e-12 * Vector3f::dot(d, d)) {
+            a2 = a1 = 0;    // along the axis
+        }
+        int stack[64], top = 0, num = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            int node = stack[--top];
+            const Shell &s = shells[node];
+            float parts[4];
+            int num_parts = cylinderSpans(s, o, d, a2, a1, a0, tmin, tmax, parts);
+            if (num_parts == 0) {
+                continue;
+            }
+            if (s.left >= 0) {
+                stack[top++] = s.right;
+                stack[top++] = s.left;
+                continue;
+            }
+            for (int i = 0; i < num_parts; i++) {
+                Span span = {parts[2 * i], parts[2 * i + 1], node};
+                if (num < MAX_SPANS) {
+                    spans[num++] = span;
+                    continue;
+                }
+                int last = 0;
+                for (int j = 1; j < MAX_SPANS; j++) {
+                    if (spans[j].t0 > spans[last].t0) last = j;
+                }
+                if (span.t0 < spans[last].t0) spans[last] = span;
+            }
+        }
+        return num;
+    }
+
+    // the parts of [tmin, tmax] where the ray is in the annular cylinder of a shell, two when it passes
+    // the hole
+    static int cylinderSpans(const Shell &s, const Vector3f &o, const Vector3f &d, double a2, double a1, double a0,
+                             double tmin, double tmax, float *parts) {
+        double ta = tmin, tb = tmax;
+        if (d.y() != 0) {
+            double t0 = (s.y0 - o.y()) / d.y(), t1 = (s.y1 - o.y()) / d.y();
+            ta = fmax(ta, fmin(t0, t1));
+            tb = fmin(tb, fmax(t0, t1));
+        } else if (o.y() < s.y0 || o.y() > s.y1) {
+            return 0;
+        }
+        double c0, c1;
+        if (ta > tb || !belowZero(a2, a1, a0 - (double) s.rho1 * s.rho1, c0, c1)) {
+            return 0;
+        }
+        ta = fmax(ta, c0);
+        tb = fmin(tb, c1);
+        if (ta > tb) {
+            return 0;
+        }
+        int num = 0;
+        if (s.rho0 > 0 && belowZero(a2, a1, a0 - (double) s.rho0 * s.rho0, c0, c1) && c0 < tb && c1 > ta) {
+            if (ta < c0) {
+                parts[0] = ta; parts[1] = c0;
+                num++;
+            }
+            if (c1 < tb) {
+                parts[2 * num] = c1; parts[2 * num + 1] = tb;
+                num++;
+            }
+            return num;
+        }
+        parts[0] = ta; parts[1] = tb;
+        return 1;
+    }
+
+    // the interval [c0, c1] where a2 t^2 + a1 t + a0 <= 0, for a2 >= 0. false when there is none
+    static bool belowZero(double a2, double a1, double a0, double &c0, double &c1) {
+        if (a2 == 0) {
+            c0 = -DBL_MAX; c1 = DBL_MAX;
+            return a0 <= 0;
+        }
+        double disc = a1 * a1 - 4 * a2 * a0;
+        if (disc < 0) {
+            return false;
+        }
+        double q = -0.5 * (a1 + (a1 < 0 ? -sqrt(disc) : sqrt(disc)));
+        c0 = q / a2;
+        c1 = q != 0 ? a0 / q : c0;
+        if (c0 > c1) std::swap(c0, c1);
+        return true;
+    }
+
+    // where newton's method starts in the span of a leaf. the parts of the span in the hull of the leaf are
+    // between the crossings of the cones of its sides, and in a part the ray crosses the curve where it
+    // changes sides of it. the first change is the start. when the ray stays on one side, it may still
+    // graze the curve where it comes closest, the start when that is near enough. false otherwise, the ray
+    // misses the leaf
+    bool seed(const Ray &r, const Shell &s, const Span &span, float &t, float &phi) const {
+        if (s.side == 0) {
+            // the phi of the projection on the chord
+            t = span.t0;
+            Vector3f p = r.pointAtParameter(t);
+            float u = (sqrt(p.x() * p.x() + p.z() * p.z()) - s.ax) * s.dx + (p.y() - s.ay) * s.dy;
+            u = s.len > 0 ? u / s.len : 0.5f;
+            phi = s.phi0 + fmin(fmax(u, 0.0f), 1.0f) * (s.phi1 - s.phi0);
+            return true;
+        }
+        // the crossings of the sides in the span, in order
+        double crossings[4];
+        int num = 0;
+        const Vector3f &o = r.getOrigin(), &d = r.getDirection();
+        double a2 = d.x() * d.x() + d.z() * d.z();
+        double a1 = 2 * (o.x() * d.x() + o.z() * d.z());
+        double a0 = o.x() * o.x() + o.z() * o.z();
+        // a side is where mr * rho + my * y = offset + mr * ax + my * ay, with the normal (mr, my) of the chord
+        double mr = s.dy, my = -s.dx;
+        for (int k = 0; k < 2; k++) {
+            // mr * rho = w0 + w1 t along the ray
+            double w0 = (k ? s.hi : s.lo) + mr * s.ax + my * s.ay - my * o.y();
+            double w1 = -my * d.y();
+            double roots[2];
+            int num_roots = 0;
+            if (fabs(mr) < 1e-5) {
+                // a flat hull, the sides are planes in y
+                if (w1 != 0) roots[num_roots++] = -w0 / w1;
+            } else {
+                // squared, the cone of the side and its mirror
+                double A = mr * mr * a2 - w1 * w1;
+                double B = mr * mr * a1 - 2 * w0 * w1;
+                double C = mr * mr * a0 - w0 * w0;
+                double disc = B * B - 4 * A * C;
+                if (disc < 0) continue;
+                double q = -0.5 * (B + (B < 0 ? -sqrt(disc) : sqrt(disc)));
+                if (A != 0) roots[num_roots++] = q / A;
+                if (q != 0) roots[num_roots++] = C / q;
+            }
+            for (int i = 0; i < num_roots; i++) {
+                double tt = roots[i];
+                if (!(tt > span.t0 && tt < span.t1)) continue;
+                if (fabs(mr) >= 1e-5 && (w0 + w1 * tt) * mr < 0) continue;    // on the mirror
+                int m = num++;
+                while (m > 0 && crossings[m - 1] > tt) {
+                    crossings[m] = crossings[m - 1];
+                    m--;
+                }
+                crossings[m] = tt;
+            }
+        }
+        // between two crossings the ray is in or out of the hull all along, the curve holds the ends of the
+        // chord so the ends of the hull along it are not crossed in between
+        double width = s.hi - s.lo;
+        double dir_len = d.length();
+        Sample nearest = {(float) (GRAZE * width), 0, 0};
+        double start = span.t0;
+        for (int i = 0; i <= num; i++) {
+            double end = i < num ? crossings[i] : span.t1;
+            double offset = hullOffset(r, s, (start + end) / 2);
+            if (offset >= s.lo && offset <= s.hi &&
+                crossingIn(r, s, start, end, fmin(8.0, 1 + dir_len * (end - start) / width), t, phi, nearest)) {
+                return true;
+            }
+            start = end;
+        }
+        if (nearest.t == 0) {
+            return false;
+        }
+        t = nearest.t;
+        phi = nearest.phi;
+        return true;
+    }
+
+    // the offset of the point at t from the chord of a leaf
+    static double hullOffset(const Ray &r, const Shell &s, double t) {
+        Vector3f p = r.pointAtParameter(t);
+        double qx = sqrt(p.x() * p.x() + p.z() * p.z()) - s.ax, qy = p.y() - s.ay;
+        return qx * s.dy - qy * s.dx;
+    }
+
+    // how far the point at t is across the curve of a leaf, from the offset of the curve at its place
+    // along the chord, > 0 on the side of hi
+    float sideOfCurve(const Ray &r, const Shell &s, double t, float &phi) const {
+        Vector3f p = r.pointAtParameter(t);
+        float qx = sqrt(p.x() * p.x() + p.z() * p.z()) - s.ax, qy = p.y() - s.ay;
+        float along = qx * s.dx + qy * s.dy, offset = qx * s.dy - qy * s.dx;
+        // the phi of the curve at along, by newton from the proportion of the chord
+        float u = s.len > 0 ? fmin(fmax(along / s.len, 0.0f), 1.0f) : 0.5f;
+        phi = s.phi0 + u * (s.phi1 - s.phi0);
+        CurvePoint cp = curvePoint(phi);
+        for (int i = 0; i < SIDE_ITER; i++) {
+            float cx = fabs(cp.V.x()) - s.ax, cy = cp.V.y() - s.ay;
+            float tx = cp.V.x() < 0 ? -cp.T.x() : cp.T.x();
+            float rate = tx * s.dx + cp.T.y() * s.dy;
+            if (rate == 0) break;
+            phi = fmin(fmax(phi + (along - (cx * s.dx + cy * s.dy)) / rate, s.phi0), s.phi1);
+            cp = curvePoint(phi);
+        }
+        return offset - ((fabs(cp.V.x()) - s.ax) * s.dy - (cp.V.y() - s.ay) * s.dx);
+    }
+
+    // the first change of side of the curve in [t0, t1] at samples points. nearest keeps the sample
+    // closest to the curve, if closer than it is and the ray comes nearer to the curve before it and goes
+    // away after it, a ray leaving the curve is not near it. a ray that starts on the curve is on no side
+    // of it at t0, the side a short step away counts from the start
+    bool crossingIn(const Ray &r, const Shell &s, double t0, double t1, int samples, float &t, float &phi,
+                    Sample &nearest) const {
+        double a = t0;
+        float pa, pb;
+        float fa = sideOfCurve(r, s, a, pa);
+        if (fabs(fa) < ON_CURVE * (s.hi - s.lo)) {
+            a = t0 + (t1 - t0) / (8 * samples);
+            fa = sideOfCurve(r, s, a, pa);
+        }
+        float before = 0;   // how far from the curve the sample before a is, the first has none
+        for (int i = 1; i <= samples; i++) {
+            double b = t0 + (t1 - t0) * i / samples;
+            float fb = sideOfCurve(r, s, b, pb);
+            if (fabs(fa) < before && fabs(fa) <= fabs(fb) && fabs(fa) < nearest.side) {
+                nearest = {fabs(fa), (float) a, pa};
+            }
+            if ((fa <= 0) != (fb <= 0)) {
+                // the secant, newton's method makes up the rest
+                float w = fa / (fa - fb);
+                t = a + (b - a) * w;
+                phi = pa + (pb - pa) * w;
+                return true;
+            }
+            before = fabs(fa);
+            a = b;
+            fa = fb;
+            pa = pb;
+        }
+        return false;
+    }
 };
 
 #endif //REVSURFACE_HPP
@@ -0,0 +1,106 @@
+/**
+ * Samplers of the random numbers of a path
+ * a sample asks for its numbers one dimension at a time: the pixel jitter, the lens and the time of the
+ * camera ray, then the lobe and the direction of each bounce. the independent sampler draws them from the
+ * generator of the thread. the sobol sampler gives every dimension of a pixel an owen scrambled sobol
+ * sequence over the samples of the pixel, shuffled per pixel and per dimension (Burley 2020, practical
+ * hash-based owen scrambling), so the first 2^k samples of a pixel stratify each pair of dimensions
+*/
+#pragma once
+
+#include <cstdint>
+#include <vecmath.h>
+
+#include "rand.hpp"
+
+class Sampler {
+public:
+    enum Type { INDEPENDENT, SOBOL };
+
+    Type type;
+
+    explicit Sampler(Type type = INDEPENDENT) : type(type) {}
+
+    // sample index of pixel, from the first dimension. seed is the seed of the render
+    void startSample(uint64_t pixel, uint32_t index, uint64_t seed) {
+        scramble = (uint32_t)mix_seed(mix_seed(seed) ^ pixel);
+        this->index = index;
+        dim = 0;
+    }
+
+    // 0 ~ 1, never 1
+    float get1D() {
+        if (type == INDEPENDENT) return RAND_UNIFORM;
+        uint32_t seed = hash(scramble, dim++);
+        uint32_t i = nested_uniform_scramble(index, seed);
+        return toFloat(nested_uniform_scramble(reverse_bits(i), hash(seed, 1)));
+    }
+
+    // two dimensions of the same (0, 2) sequence
+    Vector2f get2D() {
+        if (type == INDEPENDENT) {
+            float u1 = RAND_UNIFORM;
+            return Vector2f(u1, RAND_UNIFORM);
+        }
+        uint32_t seed = hash(scramble, dim);
+        dim += 2;
+        uint32_t i = nested_uniform_scramble(index, seed);
+        return Vector2f(toFloat(nested_uniform_scramble(reverse_bits(i), hash(seed, 1))),
+                        toFloat(nested_uniform_scramble(sobol1(i), hash(seed, 2))));
+    }
+
+private:
+    uint32_t scramble = 0;  // per pixel
+    uint32_t index = 0;     // of the sample in the pixel
+    uint32_t dim = 0;       // next dimension
+
+    static inline uint32_t reverse_bits(uint32_t x) {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+        x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    // the second sobol dimension, the first is reverse_bits. both are bit reversed fractions
+    static inline uint32_t sobol1(uint32_t i) {
+        uint32_t r = 0;
+        for (uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+            if (i & 1) r ^= v;
+        }
+        return r;
+    }
+
+    // Laine-Karras permutation of the reversed bits, an owen scramble of the fraction x / 2^32
+    static inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+        x = reverse_bits(x);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return reverse_bits(x);
+    }
+
+    static inline uint32_t hash(uint32_t a, uint32_t b) {
+        return (uint32_t)mix_seed(((uint64_t)a << 32) | b);
+    }
+
+    static inline float toFloat(uint32_t x) {
+        return (x >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+// the sampler of the path the thread is tracing, for the objects that sample while they are intersected
+// (media). only set around the intersection of a path ray, a lane of a packet or a shadow ray, the others
+// draw from the generator of the thread
+inline Sampler *&thread_sampler() {
+    static thread_local Sampler *sampler = nullptr;
+    return sampler;
+}
+
+// for the callers without a sampler of their own. an independent sampler keeps no state, so one is shared
+inline Sampler &independent_sampler() {
+    static Sampler sampler(Sampler::INDEPENDENT);
+    return sampler;
+}
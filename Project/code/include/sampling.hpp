@@ -0,0 +1,80 @@
+/**
+ * Sampling utilities shared by the objects (light sampling) and the path tracer
+*/
+#pragma once
+
+#include <cmath>
+#include <vecmath.h>
+
+// build u, v so that (u, v, w) is an orthonormal basis, w must be unit
+inline void make_basis(const Vector3f &w, Vector3f &u, Vector3f &v) {
+    // Duff et al. 2017, branchless except for the sign
+    float sign = w.z() >= 0 ? 1.0f : -1.0f;
+    float a = -1.0f / (sign + w.z());
+    float b = w.x() * w.y() * a;
+    u = Vector3f(1.0f + sign * w.x() * w.x() * a, sign * b, -sign * w.x());
+    v = Vector3f(b, sign + w.y() * w.y() * a, -w.y());
+}
+
+// uniform direction on the unit sphere
+inline Vector3f uniform_sphere(float u1, float u2) {
+    float z = 1 - 2 * u1;
+    float r = sqrt(fmax(0.0f, 1 - z * z));
+    float phi = 2 * M_PI * u2;
+    return Vector3f(r * cos(phi), r * sin(phi), z);
+}
+
+// Shirley-Chiu concentric map of the unit square to the unit disk, keeps the strata of the square
+inline void concentric_disk(float u1, float u2, float &x, float &y) {
+    float a = 2 * u1 - 1, b = 2 * u2 - 1;
+    if (a == 0 && b == 0) {
+        x = y = 0;
+        return;
+    }
+    float r, phi;
+    if (fabs(a) > fabs(b)) {
+        r = a;
+        phi = (M_PI / 4) * (b / a);
+    } else {
+        r = b;
+        phi = (M_PI / 2) - (M_PI / 4) * (a / b);
+    }
+    x = r * cos(phi);
+    y = r * sin(phi);
+}
+
+// cosine weighted direction around the unit vector n (Malley's method), pdf is cosine_hemisphere_pdf
+inline Vector3f cosine_hemisphere(const Vector3f &n, float u1, float u2) {
+    float x, y;
+    concentric_disk(u1, u2, x, y);
+    float z = sqrt(fmax(0.0f, 1 - x * x - y * y));
+    Vector3f u, v;
+    make_basis(n, u, v);
+    return x * u + y * v + z * n;
+}
+
+// solid angle pdf of cosine_hemisphere, cos is between n and the direction
+inline float cosine_hemisphere_pdf(float cos) {
+    return fmax(0.0f, cos) / M_PI;
+}
+
+// uniform barycentric coordinates (b1, b2) on a triangle, the first vertex gets 1 - b1 - b2
+inline void uniform_triangle(float u1, float u2, float &b1, float &b2) {
+    float su = sqrt(u1);
+    b1 = u2 * su;
+    b2 = 1 - su;
+}
+
+// convert a pdf over area to a pdf over solid angle, cos is between the surface normal and the direction
+inline float area_to_solid_angle(float pdf_area, float dist, float cos) {
+    cos = fabs(cos);
+    if (cos < 1e-6) return 0;
+    return pdf_area * dist * dist / cos;
+}
+
+// power heuristic with beta = 2 for multiple importance sampling
+inline float power_heuristic(float pdf_a, float pdf_b) {
+    float a = pdf_a * pdf_a, b = pdf_b * pdf_b;
+    if (a + b <= 0) return 0;
+    return a / (a + b);
+}
@@ -2,6 +2,7 @@
 #define SCENE_PARSER_H
 
 #include <cassert>
+#include <vector>
 #include <vecmath.h>
 
 class Camera;
@@ -19,6 +20,7 @@ class Curve;
 class RevSurface;
 class Box;
 class Media;
+struct BVHConfig;
 
 #define MAX_PARSER_TOKEN_LENGTH 1024
 
@@ -60,6 +62,11 @@ public:
         return group;
     }
 
+    // emissive objects that can be sampled as area lights, in world space
+    const std::vector<Object3D *> &getEmitters() const {
+        return emitters;
+    }
+
 private:
 
     void parseFile();
@@ -72,6 +79,7 @@ private:
     Material *parseMaterial();
     Object3D *parseObject(char token[MAX_PARSER_TOKEN_LENGTH]);
     Group *parseGroup();
+    BVHConfig parseBVH();
     Sphere *parseSphere();
     MovingSphere *parseMovingSphere();
     Plane *parsePlane();
@@ -80,9 +88,10 @@ private:
     Transform *parseTransform();
     Curve *parseBezierCurve();
     Curve *parseBsplineCurve();
-    RevSurface *parseRevSurface();
+    Object3D *parseRevSurface();
     Box* parseBox();
     Media* parseMedia();
+    void addEmitter(Object3D *object);
 
     int getToken(char token[MAX_PARSER_TOKEN_LENGTH]);
 
@@ -99,7 +108,10 @@ private:
     int num_materials;
     Material **materials;
     Material *current_material;
+    BVHConfig *current_bvh_config;  // of the last BVH block, for the triangles of the meshes which follow
     Group *group;
+    std::vector<Object3D *> emitters;
+    int local_depth;    // > 0 inside a Transform or a Media, where objects are not in world space or not surfaces
 };
 
 #endif // SCENE_PARSER_H
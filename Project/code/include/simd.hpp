@@ -0,0 +1,97 @@
+/**
+ * 4 wide float vector for the ray packets and the wide bvh
+ * sse when the compiler has it, plain loops otherwise. the lanes round exactly like scalar floats,
+ * so a test written with Float4 gives the same bits as the scalar code doing the same operations
+*/
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE 1
+#endif
+
+struct Float4 {
+#ifdef SIMD_SSE
+    union {
+        __m128 v;
+        float f[4];
+    };
+
+    Float4() {}
+    Float4(__m128 v) : v(v) {}
+    explicit Float4(float x) : v(_mm_set1_ps(x)) {}
+    Float4(float a, float b, float c, float d) : v(_mm_setr_ps(a, b, c, d)) {}
+    static Float4 load(const float *p) { return _mm_loadu_ps(p); }
+
+    friend Float4 operator+(const Float4 &a, const Float4 &b) { return _mm_add_ps(a.v, b.v); }
+    friend Float4 operator-(const Float4 &a, const Float4 &b) { return _mm_sub_ps(a.v, b.v); }
+    friend Float4 operator*(const Float4 &a, const Float4 &b) { return _mm_mul_ps(a.v, b.v); }
+    friend Float4 operator/(const Float4 &a, const Float4 &b) { return _mm_div_ps(a.v, b.v); }
+    friend Float4 sqrt(const Float4 &a) { return _mm_sqrt_ps(a.v); }
+
+    // comparisons give all ones in the lanes where they hold, false for NaN like the scalar ones
+    friend Float4 operator<(const Float4 &a, const Float4 &b) { return _mm_cmplt_ps(a.v, b.v); }
+    friend Float4 operator<=(const Float4 &a, const Float4 &b) { return _mm_cmple_ps(a.v, b.v); }
+    friend Float4 operator>(const Float4 &a, const Float4 &b) { return _mm_cmpgt_ps(a.v, b.v); }
+    friend Float4 operator>=(const Float4 &a, const Float4 &b) { return _mm_cmpge_ps(a.v, b.v); }
+    friend Float4 operator&(const Float4 &a, const Float4 &b) { return _mm_and_ps(a.v, b.v); }
+    friend Float4 operator|(const Float4 &a, const Float4 &b) { return _mm_or_ps(a.v, b.v); }
+    friend Float4 andnot(const Float4 &a, const Float4 &b) { return _mm_andnot_ps(a.v, b.v); }  // ~a & b
+
+    // mask ? a : b
+    friend Float4 select(const Float4 &mask, const Float4 &a, const Float4 &b) {
+        return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+    }
+    // one bit per lane
+    friend int movemask(const Float4 &mask) { return _mm_movemask_ps(mask.v); }
+    friend Float4 abs(const Float4 &a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+
+    // a mask from the low 4 bits of bits
+    static Float4 fromBits(int bits) {
+        __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+        __m128i set = _mm_and_si128(_mm_set1_epi32(bits), lanes);
+        return _mm_castsi128_ps(_mm_cmpeq_epi32(set, lanes));
+    }
+#else
+    float f[4];
+
+    Float4() {}
+    explicit Float4(float x) { f[0] = f[1] = f[2] = f[3] = x; }
+    Float4(float a, float b, float c, float d) { f[0] = a; f[1] = b; f[2] = c; f[3] = d; }
+    static Float4 load(const float *p) { return Float4(p[0], p[1], p[2], p[3]); }
+
+#define FLOAT4_LANES(expr) Float4 r; for (int i = 0; i < 4; i++) r.f[i] = (expr); return r;
+    static float bits(bool b) { uint32_t u = b ? 0xffffffffu : 0; float x; memcpy(&x, &u, 4); return x; }
+    static uint32_t asBits(float x) { uint32_t u; memcpy(&u, &x, 4); return u; }
+    static float fromUint(uint32_t u) { float x; memcpy(&x, &u, 4); return x; }
+
+    friend Float4 operator+(const Float4 &a, const Float4 &b) { FLOAT4_LANES(a.f[i] + b.f[i]) }
+    friend Float4 operator-(const Float4 &a, const Float4 &b) { FLOAT4_LANES(a.f[i] - b.f[i]) }
+    friend Float4 operator*(const Float4 &a, const Float4 &b) { FLOAT4_LANES(a.f[i] * b.f[i]) }
+    friend Float4 operator/(const Float4 &a, const Float4 &b) { FLOAT4_LANES(a.f[i] / b.f[i]) }
+    friend Float4 sqrt(const Float4 &a) { FLOAT4_LANES(std::sqrt(a.f[i])) }
+    friend Float4 operator<(const Float4 &a, const Float4 &b) { FLOAT4_LANES(bits(a.f[i] < b.f[i])) }
+    friend Float4 operator<=(const Float4 &a, const Float4 &b) { FLOAT4_LANES(bits(a.f[i] <= b.f[i])) }
+    friend Float4 operator>(const Float4 &a, const Float4 &b) { FLOAT4_LANES(bits(a.f[i] > b.f[i])) }
+    friend Float4 operator>=(const Float4 &a, const Float4 &b) { FLOAT4_LANES(bits(a.f[i] >= b.f[i])) }
+    friend Float4 operator&(const Float4 &a, const Float4 &b) { FLOAT4_LANES(fromUint(asBits(a.f[i]) & asBits(b.f[i]))) }
+    friend Float4 operator|(const Float4 &a, const Float4 &b) { FLOAT4_LANES(fromUint(asBits(a.f[i]) | asBits(b.f[i]))) }
+    friend Float4 andnot(const Float4 &a, const Float4 &b) { FLOAT4_LANES(fromUint(~asBits(a.f[i]) & asBits(b.f[i]))) }
+    friend Float4 select(const Float4 &mask, const Float4 &a, const Float4 &b) { FLOAT4_LANES(asBits(mask.f[i]) ? a.f[i] : b.f[i]) }
+    friend int movemask(const Float4 &mask) {
+        int m = 0;
+        for (int i = 0; i < 4; i++) m |= (asBits(mask.f[i]) >> 31) << i;
+        return m;
+    }
+    friend Float4 abs(const Float4 &a) { FLOAT4_LANES(std::fabs(a.f[i])) }
+    static Float4 fromBits(int m) { FLOAT4_LANES(bits((m >> i) & 1)) }
+#undef FLOAT4_LANES
+#endif
+
+    float operator[](int i) const { return f[i]; }
+    float &operator[](int i) { return f[i]; }
+};
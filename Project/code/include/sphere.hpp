@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "object3d.hpp"
+#include "sampling.hpp"
 #include <vecmath.h>
 #include <cmath>
 
@@ -52,6 +53,7 @@ public:
                 Vector3f n = (r.pointAtParameter(t) - _center) / _radius;
                 get_uv(n, u, v);
                 h.set(t, material, n, u, v);
+                h.object = this;
                 // printf("t: %f\n", t);
                 return true;
             }
@@ -65,6 +67,7 @@ public:
                 Vector3f n = (r.pointAtParameter(t1) - _center) / _radius;
                 get_uv(n, u, v);
                 h.set(t1, material, n, u, v);
+                h.object = this;
                 // printf("t1: %f\n", t1);
                 return true;
             } else if (t2 >= tmin && t2 <= h.getT()) {
@@ -72,6 +75,7 @@ public:
                 Vector3f n = (r.pointAtParameter(t2) - _center) / _radius;
                 get_uv(n, u, v);
                 h.set(t2, material, n, u, v);
+                h.object = this;
                 // printf("t2: %f\n", t2);
                 // h.set(t2, material, (r.pointAtParameter(t2) - _center) / _radius);
                 return true;
@@ -80,6 +84,61 @@ public:
         return false;
     }
 
+    // intersect on the lanes of a packet, the operations are the scalar ones so the hits are the same
+    int intersectPacket(RayPacket &p, float tmin, int mask) override {
+        Float4 ocx = Float4(_center.x()) - p.ox;
+        Float4 ocy = Float4(_center.y()) - p.oy;
+        Float4 ocz = Float4(_center.z()) - p.oz;
+        Float4 oc_squared_len = ocx * ocx + ocy * ocy + ocz * ocz;
+        Float4 r2(_radius * _radius);
+        Float4 in_sphere = oc_squared_len < r2;
+        // dot with r.getDirection().normalized()
+        Float4 len = sqrt(p.dx * p.dx + p.dy * p.dy + p.dz * p.dz);
+        Float4 t_ca = ocx * (p.dx / len) + ocy * (p.dy / len) + ocz * (p.dz / len);
+        Float4 t_hc_squared = r2 - oc_squared_len + t_ca * t_ca;
+        Float4 behind = andnot(in_sphere, t_ca < Float4(0.0f));
+        mask &= ~movemask(behind | (t_hc_squared < Float4(0.0f)));
+        if (!mask) return 0;
+
+        // a tangent ray has t_hc = 0, both roots are t_ca
+        Float4 t_hc = sqrt(t_hc_squared);
+        Float4 t1 = t_ca - t_hc;
+        Float4 t2 = t_ca + t_hc;
+        Float4 lo(tmin);
+        Float4 near = (t1 >= lo) & (t1 <= p.t);
+        Float4 far = (t2 >= lo) & (t2 <= p.t);
+        Float4 t = select(near, t1, t2);
+        int hits = mask & movemask(near | far);
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            if (!(hits >> i & 1)) continue;
+            float u, v;
+            Vector3f n = (p.ray[i]->pointAtParameter(t[i]) - _center) / _radius;
+            get_uv(n, u, v);
+            p.hit[i]->set(t[i], material, n, u, v);
+            p.hit[i]->object = this;
+            p.sync(i);
+        }
+        return hits;
+    }
+
+    // same roots as intersect, without the normal and uv
+    bool occluded(const Ray &r, float tmin, float tmax) override {
+        Vector3f oc = _center - r.getOrigin();
+        float oc_squared_len = oc.squaredLength();
+        float t_ca = Vector3f::dot(oc, r.getDirection().normalized());
+        if (t_ca < 0 && oc_squared_len >= _radius * _radius) {
+            return false;
+        }
+        float t_hc_squared = _radius * _radius - oc_squared_len + t_ca * t_ca;
+        if (t_hc_squared < 0) {
+            return false;
+        }
+        float t_hc = sqrt(t_hc_squared);
+        float t1 = t_ca - t_hc;
+        float t2 = t_ca + t_hc;
+        return (t1 >= tmin && t1 < tmax) || (t2 >= tmin && t2 < tmax);
+    }
+
     bool bounding_box(double _time0, double _time1, AABB &output_box) override {
         // bounding box of a sphere
         output_box = AABB(_center - Vector3f(_radius, _radius, _radius),
@@ -89,6 +148,51 @@ public:
 
     bool finite() override { return true; }
 
+    // from outside, sample the cone of directions the sphere covers; from inside, sample the surface
+    bool sampleLight(const Vector3f &p, const Vector2f &u, Vector3f &dir, float &dist, float &pdf) override {
+        Vector3f pc = _center - p;
+        float d2 = pc.squaredLength();
+        float r2 = _radius * _radius;
+        if (d2 <= r2) {
+            Vector3f n = uniform_sphere(u.x(), u.y());
+            Vector3f pq = _center + _radius * n - p;
+            dist = pq.length();
+            if (dist < 1e-6) return false;
+            dir = pq / dist;
+            pdf = area_to_solid_angle(1 / (4 * M_PI * r2), dist, Vector3f::dot(n, dir));
+            return pdf > 0;
+        }
+        float d = sqrt(d2);
+        float sin2_max = r2 / d2;
+        float cos_max = sqrt(fmax(0.0f, 1 - sin2_max));
+        // 1 - cos_max without the cancellation for far spheres
+        float one_minus_cos_max = sin2_max / (1 + cos_max);
+        float cos_theta = 1 - u.x() * one_minus_cos_max;
+        float sin2_theta = fmax(0.0f, 1 - cos_theta * cos_theta);
+        float phi = 2 * M_PI * u.y();
+        Vector3f w = pc / d, s, t;
+        make_basis(w, s, t);
+        dir = (cos(phi) * s + sin(phi) * t) * sqrt(sin2_theta) + cos_theta * w;
+        // near intersection along dir
+        dist = d * cos_theta - sqrt(fmax(0.0f, r2 - d2 * sin2_theta));
+        pdf = 1 / (2 * M_PI * one_minus_cos_max);
+        return true;
+    }
+
+    float lightPdf(const Ray &r, float &t) override {
+        Hit hit;
+        if (!intersect(r, hit, 1e-3)) return 0;
+        t = hit.getT();
+        Vector3f pc = _center - r.getOrigin();
+        float d2 = pc.squaredLength();
+        float r2 = _radius * _radius;
+        if (d2 <= r2) {
+            return area_to_solid_angle(1 / (4 * M_PI * r2), t, Vector3f::dot(hit.getNormal(), r.getDirection()));
+        }
+        float sin2_max = r2 / d2;
+        return 1 / (2 * M_PI * sin2_max / (1 + sqrt(fmax(0.0f, 1 - sin2_max))));
+    }
+
     void get_uv(const Vector3f &n, float &u, float &v) {
         // https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle/barycentric-coordinates
         float phi = atan2(n.z(), n.x());
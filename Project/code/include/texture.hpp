@@ -100,8 +100,8 @@ public:
     }
 
     void permute(int *p, int n) {
-        // set random seed as time
-        srand48(time(nullptr));
+        // fixed seed, so the same scene always gets the same noise
+        srand48(0);
         for (int i = n - 1; i > 0; --i) {
             int target = int(drand48() * (i + 1));
             int tmp = p[i];
@@ -0,0 +1,135 @@
+/**
+ * Tile scheduler for the renderers
+ * the image is cut into square tiles in morton order, each thread owns a deque of them
+ * and steals from the back of the others when its own is empty
+ */
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <cstdint>
+#include <omp.h>
+
+struct Tile {
+    int x0, y0;     // first pixel
+    int x1, y1;     // one past the last pixel
+};
+
+class TileScheduler {
+public:
+    TileScheduler(int width, int height, int tile_size = 32) : width(width), height(height), tile_size(tile_size) {
+        int nx = (width + tile_size - 1) / tile_size;
+        int ny = (height + tile_size - 1) / tile_size;
+        std::vector<std::pair<uint32_t, Tile>> ordered;
+        for (int ty = 0; ty < ny; ty++) {
+            for (int tx = 0; tx < nx; tx++) {
+                Tile tile;
+                tile.x0 = tx * tile_size;
+                tile.y0 = ty * tile_size;
+                tile.x1 = std::min(tile.x0 + tile_size, width);
+                tile.y1 = std::min(tile.y0 + tile_size, height);
+                ordered.push_back(std::make_pair(morton(tx, ty), tile));
+            }
+        }
+        // neighbouring tiles stay close in the order, so each thread works on one region
+        std::sort(ordered.begin(), ordered.end(), [](const std::pair<uint32_t, Tile> &a, const std::pair<uint32_t, Tile> &b) {
+            return a.first < b.first;
+        });
+        for (const auto &item : ordered) {
+            tiles.push_back(item.second);
+        }
+    }
+
+    const std::vector<Tile> &getTiles() const {
+        return tiles;
+    }
+
+    // call render_tile(tile) once for every tile, on all the openmp threads
+    template <typename F>
+    void run(F render_tile, bool show_progress = true) {
+        int num_threads = omp_get_max_threads();
+        std::vector<TileQueue> queues(num_threads);
+        // contiguous runs of the morton order for each thread
+        int num_tiles = tiles.size();
+        for (int t = 0; t < num_threads; t++) {
+            int begin = (long long)num_tiles * t / num_threads;
+            int end = (long long)num_tiles * (t + 1) / num_threads;
+            for (int i = begin; i < end; i++) {
+                queues[t].tiles.push_back(i);
+            }
+        }
+
+        std::atomic<int> done(0);
+        std::atomic<int> printed(-1);
+        time_t start = time(NULL);
+
+#pragma omp parallel num_threads(num_threads)
+        {
+            int id = omp_get_thread_num();
+            int index;
+            while (pop(queues, id, index) || steal(queues, id, index)) {
+                render_tile(tiles[index]);
+
+                int finished = ++done;
+                int percent = finished * 100 / num_tiles;
+                int last = printed.load();
+                // only the thread that moves the percentage prints
+                if (show_progress && percent > last && printed.compare_exchange_strong(last, percent)) {
+                    float ratio = (float)finished / num_tiles;
+                    float used = (float)(time(NULL) - start) / 60;
+                    float left = used / ratio - used;
+                    fprintf(stderr, "\rProgress: %.2f%%, Time: %.2fmin, Time left: %.2fmin", ratio * 100, used, left);
+                    fflush(stderr);
+                }
+            }
+        }
+    }
+
+private:
+    struct TileQueue {
+        std::mutex lock;
+        std::deque<int> tiles;
+    };
+
+    int width, height, tile_size;
+    std::vector<Tile> tiles;
+
+    // interleave the bits of x and y
+    static uint32_t morton(uint32_t x, uint32_t y) {
+        uint32_t code = 0;
+        for (int b = 0; b < 16; b++) {
+            code |= ((x >> b) & 1u) << (2 * b);
+            code |= ((y >> b) & 1u) << (2 * b + 1);
+        }
+        return code;
+    }
+
+    // the owner takes from the front
+    static bool pop(std::vector<TileQueue> &queues, int id, int &index) {
+        std::lock_guard<std::mutex> guard(queues[id].lock);
+        if (queues[id].tiles.empty()) return false;
+        index = queues[id].tiles.front();
+        queues[id].tiles.pop_front();
+        return true;
+    }
+
+    // thieves take from the back, which is the part of the region the owner reaches last
+    static bool steal(std::vector<TileQueue> &queues, int id, int &index) {
+        int n = queues.size();
+        for (int k = 1; k < n; k++) {
+            TileQueue &victim = queues[(id + k) % n];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tiles.empty()) {
+                index = victim.tiles.back();
+                victim.tiles.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+};
@@ -37,6 +37,31 @@ public:
         return inter;
     }
 
+    // the lanes are moved to the object space as in intersect and go through the packet test of the object
+    int intersectPacket(RayPacket &p, float tmin, int mask) override {
+        static_assert(PACKET_SIZE == 4, "one ray per lane");
+        Ray rays[PACKET_SIZE] = {localRay(*p.ray[0]), localRay(*p.ray[1]), localRay(*p.ray[2]), localRay(*p.ray[3])};
+        RayPacket local(rays, p);
+        int hits = o->intersectPacket(local, tmin, mask);
+        if (!hits) return 0;
+        Matrix4f normal_transform = transform.transposed();
+        for (int i = 0; i < PACKET_SIZE; i++) {
+            if (!(hits >> i & 1)) continue;
+            Hit &h = *p.hit[i];
+            h.set(h.getT(), h.getMaterial(), transformDirection(normal_transform, h.getNormal()).normalized(), h.getU(), h.getV());
+            p.sync(i);
+        }
+        return hits;
+    }
+
+    // t is the same in both spaces, the direction is not normalized
+    bool occluded(const Ray &r, float tmin, float tmax) override {
+        Vector3f trSource = transformPoint(transform, r.getOrigin());
+        Vector3f trDirection = transformDirection(transform, r.getDirection());
+        Ray tr(trSource, trDirection);
+        return o->occluded(tr, tmin, tmax);
+    }
+
     bool bounding_box(double time0, double time1, AABB &output_box) {
         if (box == nullptr) {
             if (o->bounding_box(time0, time1, output_box)) {
@@ -79,6 +104,10 @@ public:
     }
 
 protected:
+    Ray localRay(const Ray &r) const {
+        return Ray(transformPoint(transform, r.getOrigin()), transformDirection(transform, r.getDirection()));
+    }
+
     Object3D *o; //un-transformed object
     Matrix4f transform;
     AABB* box = nullptr;
@@ -2,6 +2,7 @@
 #define TRIANGLE_H
 
 #include "object3d.hpp"
+#include "sampling.hpp"
 #include <vecmath.h>
 #include <cmath>
 #include <iostream>
@@ -49,27 +50,82 @@ public:
 		if (result[0] < tmin || result[0] > hit.getT() || result[1] < 0 || result[2] < 0 || result[1] + result[2] > 1) {
 			return false;
 		} else {
-			// if normal interpolation is needed
-			if (has_normal) {
-				// use the gravity center of the tiangle to interpolate, area weighted
-				Vector3f pos = ray.pointAtParameter(result[0]);
-				Vector3f to0 = vertices[0] - pos;
-				Vector3f to1 = vertices[1] - pos;
-				Vector3f to2 = vertices[2] - pos;
-				float a0 = Vector3f::cross(to1, to2).length();
-				float a1 = Vector3f::cross(to2, to0).length();
-				float a2 = Vector3f::cross(to0, to1).length();
-				float sum = a0 + a1 + a2;
-				Vector3f n = (a0 * normals[0] + a1 * normals[1] + a2 * normals[2]) / sum;
-				n.normalize();
-				hit.set(result[0], material, n);
-			} else {
-				hit.set(result[0], material, normal);
-			}
+			setHit(ray, hit, result[0]);
 			return true;
 		}
 	}
 
+	// intersect on the lanes of a packet, the operations are the scalar ones so the hits are the same
+	int intersectPacket(RayPacket &p, float tmin, int mask) override {
+		Vector3f e1 = vertices[0] - vertices[1];
+		Vector3f e2 = vertices[0] - vertices[2];
+		Vector3f c = Vector3f::cross(e1, e2);
+		Float4 sx = Float4(vertices[0].x()) - p.ox;
+		Float4 sy = Float4(vertices[0].y()) - p.oy;
+		Float4 sz = Float4(vertices[0].z()) - p.oz;
+		Float4 cx(c.x()), cy(c.y()), cz(c.z());
+		Float4 e1x(e1.x()), e1y(e1.y()), e1z(e1.z());
+		Float4 e2x(e2.x()), e2y(e2.y()), e2z(e2.z());
+
+		Float4 under = p.dx * cx + p.dy * cy + p.dz * cz;
+		// fabs(under) < 1e-6 compares in double, in float that is <= 1e-6f
+		mask &= ~movemask(abs(under) <= Float4(1e-6f));
+		if (!mask) return 0;
+		Float4 t = (sx * cx + sy * cy + sz * cz) / under;
+		// det(dir, s, e2) and det(dir, e1, s)
+		Float4 b1 = (p.dx * (sy * e2z - sz * e2y) + p.dy * (sz * e2x - sx * e2z) + p.dz * (sx * e2y - sy * e2x)) / under;
+		Float4 b2 = (p.dx * (e1y * sz - e1z * sy) + p.dy * (e1z * sx - e1x * sz) + p.dz * (e1x * sy - e1y * sx)) / under;
+		Float4 zero(0.0f);
+		Float4 miss = (t < Float4(tmin)) | (t > p.t) | (b1 < zero) | (b2 < zero) | (b1 + b2 > Float4(1.0f));
+		int hits = mask & ~movemask(miss);
+		for (int i = 0; i < PACKET_SIZE; i++) {
+			if (!(hits >> i & 1)) continue;
+			setHit(*p.ray[i], *p.hit[i], t[i]);
+			p.sync(i);
+		}
+		return hits;
+	}
+
+	// the hit at t, with the interpolated normal if there are vertex normals
+	void setHit(const Ray &ray, Hit &hit, float t) {
+		// if normal interpolation is needed
+		if (has_normal) {
+			// use the gravity center of the tiangle to interpolate, area weighted
+			Vector3f pos = ray.pointAtParameter(t);
+			Vector3f to0 = vertices[0] - pos;
+			Vector3f to1 = vertices[1] - pos;
+			Vector3f to2 = vertices[2] - pos;
+			float a0 = Vector3f::cross(to1, to2).length();
+			float a1 = Vector3f::cross(to2, to0).length();
+			float a2 = Vector3f::cross(to0, to1).length();
+			float sum = a0 + a1 + a2;
+			Vector3f n = (a0 * normals[0] + a1 * normals[1] + a2 * normals[2]) / sum;
+			n.normalize();
+			hit.set(t, material, n);
+		} else {
+			hit.set(t, material, normal);
+		}
+		hit.object = this;
+	}
+
+	// same test as intersect, without the normal interpolation
+	bool occluded(const Ray& ray, float tmin, float tmax) override {
+		Vector3f e1 = vertices[0] - vertices[1];
+		Vector3f e2 = vertices[0] - vertices[2];
+		Vector3f s = vertices[0] - ray.getOrigin();
+		float under = det(ray.getDirection(), e1, e2);
+		if (fabs(under) < 1e-6) {
+			return false;
+		}
+		float t = det(s, e1, e2) / under;
+		if (t < tmin || t >= tmax) {
+			return false;
+		}
+		float beta = det(ray.getDirection(), s, e2) / under;
+		float gamma = det(ray.getDirection(), e1, s) / under;
+		return beta >= 0 && gamma >= 0 && beta + gamma <= 1;
+	}
+
 	bool bounding_box(double time0, double time1, AABB& output_box) override {
 		Vector3f min = vertices[0];
 		Vector3f max = vertices[0];
@@ -87,6 +143,30 @@ public:
 		return true;
 	}
 
+	// uniform over the area
+	bool sampleLight(const Vector3f &p, const Vector2f &u, Vector3f &dir, float &dist, float &pdf) override {
+		float b1, b2;
+		uniform_triangle(u.x(), u.y(), b1, b2);
+		Vector3f q = (1 - b1 - b2) * vertices[0] + b1 * vertices[1] + b2 * vertices[2];
+		Vector3f pq = q - p;
+		dist = pq.length();
+		if (dist < 1e-6) return false;
+		dir = pq / dist;
+		pdf = area_to_solid_angle(1 / area(), dist, Vector3f::dot(normal, dir));
+		return pdf > 0;
+	}
+
+	float lightPdf(const Ray &r, float &t) override {
+		Hit hit;
+		if (!intersect(r, hit, 1e-3)) return 0;
+		t = hit.getT();
+		return area_to_solid_angle(1 / area(), t, Vector3f::dot(normal, r.getDirection()));
+	}
+
+	float area() const {
+		return 0.5f * Vector3f::cross(vertices[1] - vertices[0], vertices[2] - vertices[0]).length();
+	}
+
 	// new tool function, to compute the det of three vectors
 	float det(const Vector3f& a, const Vector3f& b, const Vector3f& c) {
 		// det equals to the dot product of a and the cross product of b and c -> mixed product
@@ -0,0 +1,270 @@
+/**
+ * Wavefront path tracing
+ * the same estimator as PathTracing, but a tile keeps all of its paths in queues and runs each bounce
+ * as stages over the whole queue: generate, intersect, shade and shadow. between the stages the paths
+ * are binned, by direction octant before tracing and by material before shading, so each stage works
+ * on coherent batches. every path carries its own random generator, the image does not depend on the order
+*/
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+
+#include "pt.hpp"
+
+class WavefrontPathTracing : public PathTracing {
+public:
+    int queue_size = 1 << 14;   // paths in flight per thread, a tile runs its samples in passes of this size
+
+    WavefrontPathTracing(SceneParser *scene, std::string output_file, int rounds=100, int max_depth=10, int step=20,
+        int seed=0, bool nee=true
+    ) : PathTracing(scene, output_file, rounds, max_depth, step, seed, nee) {
+        // bigger tiles give fuller queues
+        tile_size = 64;
+        for (int i = 0; i < scene->getNumMaterials(); i++) {
+            material_index[scene->getMaterial(i)] = i;
+        }
+        num_materials = scene->getNumMaterials() + 1;   // the last bin holds the materials the parser does not list
+    }
+
+    // the passes and checkpoints of PathTracing::renderImage. every sample seeds its own generator, so the
+    // passes need no state between them and draw the same samples whatever the step
+    void renderImage(bool show_progress = true) override {
+        num_rays = 0;
+        film->reset(0);
+        std::vector<ThreadState> states(omp_get_max_threads());
+        int pass_rounds = step > 0 && step < rounds ? step : rounds;
+        for (int done = 0; done < rounds; done += pass_rounds) {
+            int n = std::min(pass_rounds, rounds - done);
+            renderTiles(width, height, [&](const Tile &tile) {
+                ThreadState &state = states[omp_get_thread_num()];
+                renderTile(tile, state, done, done + n);
+                num_rays += state.rays;
+                state.rays = 0;
+            }, show_progress);
+            if (done + n < rounds) {
+                checkpoints.save(*film, outputName(std::to_string(done + n)));
+            }
+        }
+        checkpoints.wait();
+    }
+
+private:
+    // structure of arrays, one entry per path
+    struct PathQueue {
+        std::vector<Vector3f> origin, direction, throughput;
+        std::vector<double> time;
+        std::vector<float> bsdf_pdf;    // see PathTracing::traceRay
+        std::vector<int> pixel;         // index in the tile
+        std::vector<PCG32> rng;
+        std::vector<Sampler> sampler;   // where the path is in the dimensions of its sample
+        std::vector<Hit> hit;
+        int size = 0;
+
+        void reserve(int n) {
+            origin.resize(n); direction.resize(n); throughput.resize(n);
+            time.resize(n); bsdf_pdf.resize(n); pixel.resize(n); rng.resize(n); sampler.resize(n); hit.resize(n);
+        }
+    };
+
+    // light samples waiting for their visibility test
+    struct ShadowQueue {
+        std::vector<Vector3f> origin, direction, radiance;
+        std::vector<double> time;
+        std::vector<float> dist;
+        std::vector<Object3D *> emitter;
+        std::vector<int> pixel;
+        std::vector<PCG32> rng;         // media on the way may sample
+        int size = 0;
+
+        void reserve(int n) {
+            origin.resize(n); direction.resize(n); radiance.resize(n);
+            time.resize(n); dist.resize(n); emitter.resize(n); pixel.resize(n); rng.resize(n);
+        }
+    };
+
+    struct ThreadState {
+        PathQueue paths, next;
+        ShadowQueue shadows;
+        std::vector<Vector3f> pixel_sum;    // of the samples of each pixel of the tile
+        std::vector<int> order, bins;
+        long long rays = 0;
+    };
+
+    std::unordered_map<const Material *, int> material_index;
+    int num_materials;
+
+    // the octant of a direction, 0 ~ 7
+    static inline int octant(const Vector3f &d) {
+        return (d.x() < 0) | ((d.y() < 0) << 1) | ((d.z() < 0) << 2);
+    }
+
+    int materialBin(const Material *material) const {
+        auto it = material_index.find(material);
+        return it == material_index.end() ? num_materials - 1 : it->second;
+    }
+
+    // counting sort of 0 .. n-1 by key(i) in [0, num_keys), stable
+    template <typename F>
+    static void binBy(int n, int num_keys, F key, std::vector<int> &order, std::vector<int> &bins) {
+        bins.assign(num_keys + 1, 0);
+        for (int i = 0; i < n; i++) bins[key(i) + 1]++;
+        for (int k = 0; k < num_keys; k++) bins[k + 1] += bins[k];
+        order.resize(n);
+        for (int i = 0; i < n; i++) order[bins[key(i)]++] = i;
+    }
+
+    // the samples in [begin, end) of every pixel of the tile
+    void renderTile(const Tile &tile, ThreadState &state, int begin, int end) {
+        int tile_width = tile.x1 - tile.x0;
+        int num_pixels = tile_width * (tile.y1 - tile.y0);
+        int samples_per_pass = std::max(1, std::min(end - begin, queue_size / num_pixels));
+        int capacity = num_pixels * samples_per_pass;
+        state.paths.reserve(capacity);
+        state.next.reserve(capacity);
+        state.shadows.reserve(capacity);
+        state.pixel_sum.assign(num_pixels, Vector3f::ZERO);
+        PCG32 &gen = rand_generator();
+
+        for (int first = begin; first < end; first += samples_per_pass) {
+            int samples = std::min(samples_per_pass, end - first);
+
+            // generate: camera rays, the samples of a pixel start at unrelated points of its stream
+            PathQueue &paths = state.paths;
+            paths.size = 0;
+            for (int p = 0; p < num_pixels; p++) {
+                int i = tile.x0 + p % tile_width, j = tile.y0 + p / tile_width;
+                for (int s = 0; s < samples; s++) {
+                    int k = paths.size++;
+                    seed_pixel(gen, seed, first + s, (uint64_t)j * width + i);
+                    paths.sampler[k] = pixelSampler(i, j, first + s);
+                    Ray ray = cameraRay(i, j, paths.sampler[k]);
+                    paths.origin[k] = ray.getOrigin();
+                    paths.direction[k] = ray.getDirection();
+                    paths.time[k] = ray.time;
+                    paths.throughput[k] = Vector3f(1.0, 1.0, 1.0);
+                    paths.bsdf_pdf[k] = 0;
+                    paths.pixel[k] = p;
+                    paths.rng[k] = gen;
+                }
+            }
+
+            for (int depth = 1; depth <= max_depth && state.paths.size > 0; depth++) {
+                intersectStage(state);
+                shadeStage(state, depth);
+                shadowStage(state);
+                std::swap(state.paths, state.next);
+            }
+        }
+
+        for (int p = 0; p < num_pixels; p++) {
+            film->addSamples((tile.y0 + p / tile_width) * width + tile.x0 + p % tile_width, state.pixel_sum[p], end - begin);
+        }
+    }
+
+    // closest hit of every path, misses see the background and end
+    void intersectStage(ThreadState &state) {
+        PathQueue &paths = state.paths;
+        PCG32 &gen = rand_generator();
+        binBy(paths.size, 8, [&](int i) { return octant(paths.direction[i]); }, state.order, state.bins);
+        for (int i : state.order) {
+            Ray ray(paths.origin[i], paths.direction[i], paths.time[i]);
+            gen = paths.rng[i];
+            paths.hit[i] = Hit();
+            state.rays++;
+            thread_sampler() = &paths.sampler[i];
+            bool found = group->intersect(ray, paths.hit[i], 0.001);
+            thread_sampler() = nullptr;
+            if (!found) {
+                state.pixel_sum[paths.pixel[i]] += paths.throughput[i] * scene->getBackgroundColor();
+                paths.hit[i].material = nullptr;
+            }
+            paths.rng[i] = gen;
+        }
+    }
+
+    // emission, scattering and light sampling at the hits, grouped by material.
+    // the paths that go on are written to state.next
+    void shadeStage(ThreadState &state, int depth) {
+        PathQueue &paths = state.paths;
+        PathQueue &next = state.next;
+        ShadowQueue &shadows = state.shadows;
+        PCG32 &gen = rand_generator();
+        next.size = 0;
+        shadows.size = 0;
+        binBy(paths.size, num_materials + 1, [&](int i) {
+            Material *material = paths.hit[i].getMaterial();
+            return material ? materialBin(material) : num_materials;   // misses last, they are skipped
+        }, state.order, state.bins);
+        int num_hits = state.bins[num_materials - 1];
+
+        for (int n = 0; n < num_hits; n++) {
+            int i = state.order[n];
+            Ray ray(paths.origin[i], paths.direction[i], paths.time[i]);
+            Hit &hit = paths.hit[i];
+            const Vector3f cf = paths.throughput[i];
+            gen = paths.rng[i];
+
+            Ray scattered(Vector3f::ZERO, Vector3f::ZERO);
+            Vector3f attenuation;
+            bool front = Vector3f::dot(ray.getDirection(), hit.getNormal()) < 0;
+            bool diffuse = false;
+            Material *material = hit.getMaterial();
+            if (!material->scatter(ray, hit, attenuation, scattered, front, &diffuse, &paths.sampler[i])) {
+                continue;
+            }
+            if (material->selfColor.squaredLength() > 0) {
+                state.pixel_sum[paths.pixel[i]] += cf * material->selfColor * emissionWeight(ray, hit, paths.bsdf_pdf[i]);
+            }
+            bool surface = hit.getNormal().squaredLength() > 0.5f;
+            float bsdf_pdf = 0;
+            if (nee && diffuse && surface && depth < max_depth) {
+                Vector3f normal = hit.getNormal().normalized();
+                Vector3f dir, radiance;
+                Object3D *emitter;
+                float dist;
+                if (sampleEmitter(scattered.getOrigin(), normal, &paths.sampler[i], dir, emitter, dist, radiance)) {
+                    int k = shadows.size++;
+                    shadows.origin[k] = scattered.getOrigin();
+                    shadows.direction[k] = dir;
+                    shadows.time[k] = ray.time;
+                    shadows.radiance[k] = cf * attenuation * radiance / M_PI;
+                    shadows.dist[k] = dist;
+                    shadows.emitter[k] = emitter;
+                    shadows.pixel[k] = paths.pixel[i];
+                    shadows.rng[k].set_seed(gen.next(), gen.next());
+                }
+                bsdf_pdf = Material::diffusePdf(normal, scattered.getDirection());
+            }
+
+            // the end of the loop in PathTracing::traceRay
+            Vector3f throughput = cf * attenuation;
+            if (!survive(throughput, depth) || depth + 1 > max_depth) {
+                continue;
+            }
+            int k = next.size++;
+            next.origin[k] = scattered.getOrigin();
+            next.direction[k] = scattered.getDirection();
+            next.time[k] = scattered.time;
+            next.throughput[k] = throughput;
+            next.bsdf_pdf[k] = bsdf_pdf;
+            next.pixel[k] = paths.pixel[i];
+            next.rng[k] = gen;
+            next.sampler[k] = paths.sampler[i];
+        }
+    }
+
+    // visibility of the light samples of this bounce
+    void shadowStage(ThreadState &state) {
+        ShadowQueue &shadows = state.shadows;
+        PCG32 &gen = rand_generator();
+        binBy(shadows.size, 8, [&](int i) { return octant(shadows.direction[i]); }, state.order, state.bins);
+        for (int i : state.order) {
+            gen = shadows.rng[i];
+            Ray shadow_ray(shadows.origin[i], shadows.direction[i], shadows.time[i]);
+            if (emitterVisible(shadow_ray, shadows.emitter[i], shadows.dist[i], &state.rays)) {
+                state.pixel_sum[shadows.pixel[i]] += shadows.radiance[i];
+            }
+        }
+    }
+};
@@ -0,0 +1,385 @@
+/**
+ * Benchmarks for the path tracer
+ * microbenchmarks time the kernels on fixed sets of rays, scene benchmarks render the testcases,
+ * everything is seeded so the checksums only change when the results do.
+ * the results are written as json, to be compared across commits
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <functional>
+#include <omp.h>
+
+#include "scene_parser.hpp"
+#include "image.hpp"
+#include "camera.hpp"
+#include "group.hpp"
+#include "material.hpp"
+#include "sphere.hpp"
+#include "triangle.hpp"
+#include "bounding.hpp"
+#include "bvh.hpp"
+#include "curve.hpp"
+#include "revsurface.hpp"
+#include "rand.hpp"
+#include "packet.hpp"
+
+#include "pt.hpp"
+#include "wavefront.hpp"
+
+using namespace std;
+
+struct BenchResult {
+    string group;       // "kernel" or "scene"
+    string name;
+    string renderer;    // only for the scenes, "pt" or "wavefront"
+    long long ops;      // operations of the best trial, rays for the intersections
+    double seconds;     // time of the best trial
+    double checksum;    // sum of the results, to notice when the output changes
+    // only for the scenes
+    long long samples = 0;
+    long long rays = 0;
+    double load_seconds = 0;
+};
+
+static double now() {
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// run kernel() trials times and keep the fastest, kernel returns a checksum and performs ops operations
+template <typename F>
+static BenchResult timeKernel(const string &name, long long ops, F kernel, int trials = 5) {
+    BenchResult result;
+    result.group = "kernel";
+    result.name = name;
+    result.ops = ops;
+    result.seconds = 1e30;
+    kernel();   // warm up
+    for (int i = 0; i < trials; i++) {
+        rand_seed(1, 0);
+        double start = now();
+        result.checksum = kernel();
+        result.seconds = fmin(result.seconds, now() - start);
+    }
+    fprintf(stderr, "%-24s %10.2f ns/op\n", name.c_str(), result.seconds * 1e9 / ops);
+    return result;
+}
+
+// rays from around origin towards random points of the rectangle [-w, w] x [-h, h] on z = 0
+static vector<Ray> makeRays(int count, const Vector3f &origin, float w, float h, uint64_t seed) {
+    PCG32 gen(seed, 0);
+    vector<Ray> rays;
+    rays.reserve(count);
+    for (int i = 0; i < count; i++) {
+        Vector3f o = origin + 0.1f * Vector3f(gen.uniform() - 0.5f, gen.uniform() - 0.5f, gen.uniform() - 0.5f);
+        Vector3f target((2 * gen.uniform() - 1) * w, (2 * gen.uniform() - 1) * h, 0);
+        rays.push_back(Ray(o, (target - o).normalized()));
+    }
+    return rays;
+}
+
+static void kernelBenchmarks(vector<BenchResult> &results) {
+    const int num_rays = 4096;
+    vector<Ray> rays = makeRays(num_rays, Vector3f(0, 0, 5), 1.5, 1.5, 7);
+    Material diffuse(Vector3f(0.8, 0.8, 0.8), Vector3f::ZERO, 0, Vector3f::ZERO, 1, Vector3f(1, 0, 0));
+    Material mirror(Vector3f(0.8, 0.8, 0.8), Vector3f::ZERO, 0, Vector3f::ZERO, 1, Vector3f(0, 1, 0));
+    Material glass(Vector3f(0.8, 0.8, 0.8), Vector3f::ZERO, 0, Vector3f::ZERO, 1.5, Vector3f(0, 0, 1));
+
+    Triangle triangle(Vector3f(-1, -1, 0), Vector3f(1, -1, 0), Vector3f(0, 1, 0), &diffuse);
+    results.push_back(timeKernel("triangle_intersect", 256LL * num_rays, [&]() {
+        double sum = 0;
+        for (int k = 0; k < 256; k++) {
+            for (const Ray &r : rays) {
+                Hit h;
+                if (triangle.intersect(r, h, 0.001)) sum += h.getT();
+            }
+        }
+        return sum;
+    }));
+
+    Sphere sphere(Vector3f(0, 0, 0), 1, &diffuse);
+    results.push_back(timeKernel("sphere_intersect", 256LL * num_rays, [&]() {
+        double sum = 0;
+        for (int k = 0; k < 256; k++) {
+            for (const Ray &r : rays) {
+                Hit h;
+                if (sphere.intersect(r, h, 0.001)) sum += h.getT();
+            }
+        }
+        return sum;
+    }));
+
+    AABB box(Vector3f(-1, -1, -1), Vector3f(1, 1, 1));
+    results.push_back(timeKernel("aabb_intersect", 256LL * num_rays, [&]() {
+        double sum = 0;
+        for (int k = 0; k < 256; k++) {
+            for (const Ray &r : rays) {
+                float t;
+                if (box.intersect(r, 0.001, FLT_MAX, t)) sum += t;
+            }
+        }
+        return sum;
+    }));
+
+    // the vase of curve_bezier.txt, the rays cover its silhouette
+    vector<Vector3f> profile = {Vector3f(-2, 2, 0), Vector3f(-4, 0, 0), Vector3f(0, 0, 0), Vector3f(-2, -2, 0)};
+    RevSurface revsurface(new BezierCurve(profile), &diffuse);
+    vector<Ray> rev_rays = makeRays(num_rays, Vector3f(0, 0, 12), 4.5, 2.5, 11);
+    results.push_back(timeKernel("revsurface_newton", 4LL * num_rays, [&]() {
+        double sum = 0;
+        for (int k = 0; k < 4; k++) {
+            for (const Ray &r : rev_rays) {
+                Hit h;
+                if (revsurface.newtonIterate(r, h, 0.001)) sum += h.getT();
+            }
+        }
+        return sum;
+    }));
+
+    const int num_points = 1 << 16;
+    BezierCurve bezier(profile);
+    results.push_back(timeKernel("bezier_getpoint", num_points, [&]() {
+        double sum = 0;
+        float lo = bezier.lowerBound(), hi = bezier.upperBound();
+        for (int i = 0; i < num_points; i++) {
+            CurvePoint p = bezier.getPoint(lo + (hi - lo) * (i + 0.5f) / num_points);
+            sum += p.V.x() + p.T.y();
+        }
+        return sum;
+    }));
+
+    vector<Vector3f> bspline_profile = {Vector3f(-2, 2, 0), Vector3f(-4, 1, 0), Vector3f(-1, 0, 0),
+                                        Vector3f(-3, -1, 0), Vector3f(-2, -2, 0), Vector3f(-1, -3, 0)};
+    BsplineCurve bspline(bspline_profile);
+    results.push_back(timeKernel("bspline_getpoint", num_points, [&]() {
+        double sum = 0;
+        float lo = bspline.lowerBound(), hi = bspline.upperBound();
+        for (int i = 0; i < num_points; i++) {
+            CurvePoint p = bspline.getPoint(lo + (hi - lo) * (i + 0.5f) / num_points);
+            sum += p.V.x() + p.T.y();
+        }
+        return sum;
+    }));
+
+    // the rays hit the plane z = 0 from above
+    vector<Hit> hits;
+    for (const Ray &r : rays) {
+        hits.push_back(Hit(-r.getOrigin().z() / r.getDirection().z(), &diffuse, Vector3f(0, 0, 1)));
+    }
+    Material *materials[3] = {&diffuse, &mirror, &glass};
+    const char *names[3] = {"scatter_diffuse", "scatter_specular", "scatter_refract"};
+    for (int m = 0; m < 3; m++) {
+        results.push_back(timeKernel(names[m], 64LL * num_rays, [&]() {
+            double sum = 0;
+            for (int k = 0; k < 64; k++) {
+                for (int i = 0; i < num_rays; i++) {
+                    Hit h = hits[i];
+                    Vector3f attenuation;
+                    Ray scattered(Vector3f::ZERO, Vector3f::ZERO);
+                    if (materials[m]->scatter(rays[i], h, attenuation, scattered)) sum += scattered.getDirection().z();
+                }
+            }
+            return sum;
+        }));
+    }
+}
+
+// the intersections of kernelBenchmarks on packets of the same rays, the checksums match the scalar ones.
+// the packets are set up once, as a traversal does for all the nodes a camera packet visits
+static void packetBenchmarks(vector<BenchResult> &results) {
+    const int num_rays = 4096;
+    vector<Ray> rays = makeRays(num_rays, Vector3f(0, 0, 5), 1.5, 1.5, 7);
+    Material diffuse(Vector3f(0.8, 0.8, 0.8), Vector3f::ZERO, 0, Vector3f::ZERO, 1, Vector3f(1, 0, 0));
+    vector<Hit> hits(num_rays);
+    vector<RayPacket> packets;
+    for (int i = 0; i < num_rays; i += PACKET_SIZE) {
+        packets.push_back(RayPacket(&rays[i], &hits[i]));
+    }
+    // intersect(p) returns the lanes hit and leaves their distance in p.t
+    auto run = [&](const function<int(RayPacket &)> &intersect) {
+        double sum = 0;
+        for (int k = 0; k < 256; k++) {
+            for (RayPacket &p : packets) {
+                for (int l = 0; l < PACKET_SIZE; l++) p.hit[l]->t = 1e38;
+                p.t = Float4(1e38f);
+                int mask = intersect(p);
+                for (int l = 0; l < PACKET_SIZE; l++) if (mask >> l & 1) sum += p.t[l];
+            }
+        }
+        return sum;
+    };
+
+    Triangle triangle(Vector3f(-1, -1, 0), Vector3f(1, -1, 0), Vector3f(0, 1, 0), &diffuse);
+    results.push_back(timeKernel("triangle_packet", 256LL * num_rays, [&]() {
+        return run([&](RayPacket &p) { return triangle.intersectPacket(p, 0.001, PACKET_ALL); });
+    }));
+
+    Sphere sphere(Vector3f(0, 0, 0), 1, &diffuse);
+    results.push_back(timeKernel("sphere_packet", 256LL * num_rays, [&]() {
+        return run([&](RayPacket &p) { return sphere.intersectPacket(p, 0.001, PACKET_ALL); });
+    }));
+
+    AABB box(Vector3f(-1, -1, -1), Vector3f(1, 1, 1));
+    results.push_back(timeKernel("aabb_packet", 256LL * num_rays, [&]() {
+        return run([&](RayPacket &p) {
+            Float4 t;
+            int mask = p.intersect(box, 0.001, PACKET_ALL, t);
+            p.t = t;
+            return mask;
+        });
+    }));
+}
+
+// closest hits through a bvh over a grid of spheres, binary and 4 wide. the checksums match
+static void bvhBenchmarks(vector<BenchResult> &results) {
+    const int num_rays = 4096;
+    vector<Ray> rays = makeRays(num_rays, Vector3f(0, 0, 5), 1.5, 1.5, 7);
+    Material diffuse(Vector3f(0.8, 0.8, 0.8), Vector3f::ZERO, 0, Vector3f::ZERO, 1, Vector3f(1, 0, 0));
+    vector<Object3D *> spheres;
+    for (int i = 0; i < 32; i++) {
+        for (int j = 0; j < 32; j++) {
+            for (int k = 0; k < 4; k++) {
+                Vector3f center(-1.55f + 0.1f * i, -1.55f + 0.1f * j, -0.3f * k);
+                spheres.push_back(new Sphere(center, 0.04f + 0.01f * ((i + j + k) % 3), &diffuse));
+            }
+        }
+    }
+    for (int width : {2, 4}) {
+        BVHConfig config;
+        config.width = width;
+        BVHNode bvh(spheres, 0, spheres.size(), 0, 0, config);
+        results.push_back(timeKernel("bvh" + to_string(width) + "_intersect", 16LL * num_rays, [&]() {
+            double sum = 0;
+            for (int k = 0; k < 16; k++) {
+                for (const Ray &r : rays) {
+                    Hit h;
+                    if (bvh.intersect(r, h, 0.001)) sum += h.getT();
+                }
+            }
+            return sum;
+        }));
+        results.push_back(timeKernel("bvh" + to_string(width) + "_occluded", 16LL * num_rays, [&]() {
+            double sum = 0;
+            for (int k = 0; k < 16; k++) {
+                for (const Ray &r : rays) {
+                    sum += bvh.occluded(r, 0.001, 5.5);
+                }
+            }
+            return sum;
+        }));
+    }
+    for (Object3D *sphere : spheres) {
+        delete sphere;
+    }
+}
+
+static BenchResult sceneBenchmark(const string &file, int rounds, int max_depth, bool wavefront) {
+    BenchResult result;
+    result.group = "scene";
+    result.name = file;
+    result.renderer = wavefront ? "wavefront" : "pt";
+
+    double start = now();
+    SceneParser parser(file.c_str());
+    result.load_seconds = now() - start;
+
+    PathTracing *renderer = wavefront ? new WavefrontPathTracing(&parser, "", rounds, max_depth, rounds, 0)
+                                      : new PathTracing(&parser, "", rounds, max_depth, rounds, 0);
+    PathTracing &pt = *renderer;
+    start = now();
+    pt.renderImage(false);
+    result.seconds = now() - start;
+
+    result.samples = (long long)pt.width * pt.height * rounds;
+    result.rays = pt.num_rays;
+    result.ops = result.samples;
+    result.checksum = 0;
+    for (int j = 0; j < pt.height; j++) {
+        for (int i = 0; i < pt.width; i++) {
+            Vector3f c = pt.film->getPixel(i, j);
+            result.checksum += c.x() + c.y() + c.z();
+        }
+    }
+    result.checksum /= 3.0 * pt.width * pt.height;
+    fprintf(stderr, "%-24s %-10s %10.0f samples/s %12.0f rays/s\n", file.c_str(), result.renderer.c_str(),
+            result.samples / result.seconds, result.rays / result.seconds);
+    delete renderer;
+    return result;
+}
+
+static string jsonString(const string &s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static bool writeJson(const char *filename, const vector<BenchResult> &results, int rounds, int max_depth) {
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("cannot open %s\n", filename);
+        return false;
+    }
+    fprintf(file, "{\n");
+    fprintf(file, "  \"threads\": %d,\n", omp_get_max_threads());
+#ifdef VECMATH_SSE
+    fprintf(file, "  \"vecmath_sse\": true,\n");
+#else
+    fprintf(file, "  \"vecmath_sse\": false,\n");
+#endif
+    fprintf(file, "  \"rounds\": %d,\n", rounds);
+    fprintf(file, "  \"max_depth\": %d,\n", max_depth);
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult &r = results[i];
+        fprintf(file, "    {\"group\": %s, \"name\": %s, ", jsonString(r.group).c_str(), jsonString(r.name).c_str());
+        if (r.group == "kernel") {
+            fprintf(file, "\"ops\": %lld, \"seconds\": %.6f, \"ns_per_op\": %.4f, \"ops_per_sec\": %.1f, ",
+                    r.ops, r.seconds, r.seconds * 1e9 / r.ops, r.ops / r.seconds);
+        } else {
+            fprintf(file, "\"renderer\": %s, ", jsonString(r.renderer).c_str());
+            fprintf(file, "\"samples\": %lld, \"rays\": %lld, \"load_seconds\": %.4f, \"seconds\": %.4f, "
+                    "\"samples_per_sec\": %.1f, \"rays_per_sec\": %.1f, \"ns_per_ray\": %.4f, ",
+                    r.samples, r.rays, r.load_seconds, r.seconds,
+                    r.samples / r.seconds, r.rays / r.seconds, r.seconds * 1e9 / r.rays);
+        }
+        fprintf(file, "\"checksum\": %.9g}%s\n", r.checksum, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: ./build/bench <output json file> [rounds] [max_depth] [scene files...]\n");
+        printf("       without scene files a default set of testcases is rendered, \"none\" skips the scenes\n");
+        return 1;
+    }
+    int rounds = argc > 2 ? atoi(argv[2]) : 1;
+    int max_depth = argc > 3 ? atoi(argv[3]) : 10;
+    vector<string> scenes;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "none") != 0) scenes.push_back(argv[i]);
+    }
+    if (argc <= 4) {
+        scenes = {"testcases/scene06_bunny_1k.txt", "testcases/smallpt.txt", "testcases/curve_bezier.txt",
+                  "testcases/box_media.txt", "testcases/final.txt"};
+    }
+
+    vector<BenchResult> results;
+    kernelBenchmarks(results);
+    packetBenchmarks(results);
+    bvhBenchmarks(results);
+    for (const string &scene : scenes) {
+        results.push_back(sceneBenchmark(scene, rounds, max_depth, false));
+        results.push_back(sceneBenchmark(scene, rounds, max_depth, true));
+    }
+    return writeJson(argv[1], results, rounds, max_depth) ? 0 : 1;
+}
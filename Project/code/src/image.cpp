@@ -1,6 +1,7 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <vector>
 
 #include "image.hpp"
 
@@ -219,11 +220,19 @@ struct BMPHeader
 int 
 Image::SaveBMP(const char *filename)
 {
-    int i, j, ipos;
+    return ::SaveBMP(filename, width, height, [this](int y, Vector3f *colors) {
+        for (int x = 0; x < width; x++) {
+            colors[x] = data[y * width + x];
+        }
+    });
+}
+
+std::vector<unsigned char>
+EncodeBMP(int width, int height, const std::function<void(int, Vector3f *)> &row)
+{
+    int i, j;
     int bytesPerLine;
-    unsigned char *line;
-	Vector3f*rgb = data;
-    FILE *file;
+    std::vector<Vector3f> rgb(width);
     struct BMPHeader bmph;
 
     /* The length of each line must be a multiple of 4 bytes */
@@ -246,48 +255,57 @@ Image::SaveBMP(const char *filename)
     bmph.biClrUsed = 0;       
     bmph.biClrImportant = 0; 
 
-    file = fopen (filename, "wb");
-    if (file == NULL) return(0);
-  
-    fwrite(&bmph.bfType, 2, 1, file);
-    fwrite(&bmph.bfSize, 4, 1, file);
-    fwrite(&bmph.bfReserved, 4, 1, file);
-    fwrite(&bmph.bfOffBits, 4, 1, file);
-    fwrite(&bmph.biSize, 4, 1, file);
-    fwrite(&bmph.biWidth, 4, 1, file);
-    fwrite(&bmph.biHeight, 4, 1, file);
-    fwrite(&bmph.biPlanes, 2, 1, file);
-    fwrite(&bmph.biBitCount, 2, 1, file);
-    fwrite(&bmph.biCompression, 4, 1, file);
-    fwrite(&bmph.biSizeImage, 4, 1, file);
-    fwrite(&bmph.biXPelsPerMeter, 4, 1, file);
-    fwrite(&bmph.biYPelsPerMeter, 4, 1, file);
-    fwrite(&bmph.biClrUsed, 4, 1, file);
-    fwrite(&bmph.biClrImportant, 4, 1, file);
-  
-    line = (unsigned char *)malloc(bytesPerLine);
-    if (line == NULL)
-    {
-        fprintf(stderr, "Can't allocate memory for BMP file.\n");
-        return(0);
-    }
+    // the whole file, the fields of the header are packed one after the other
+    std::vector<unsigned char> bytes(bmph.bfSize, 0);
+    unsigned char *p = bytes.data();
+    auto put = [&p](const void *field, int size) {
+        memcpy(p, field, size);
+        p += size;
+    };
+    put(&bmph.bfType, 2);
+    put(&bmph.bfSize, 4);
+    put(&bmph.bfReserved, 4);
+    put(&bmph.bfOffBits, 4);
+    put(&bmph.biSize, 4);
+    put(&bmph.biWidth, 4);
+    put(&bmph.biHeight, 4);
+    put(&bmph.biPlanes, 2);
+    put(&bmph.biBitCount, 2);
+    put(&bmph.biCompression, 4);
+    put(&bmph.biSizeImage, 4);
+    put(&bmph.biXPelsPerMeter, 4);
+    put(&bmph.biYPelsPerMeter, 4);
+    put(&bmph.biClrUsed, 4);
+    put(&bmph.biClrImportant, 4);
 
     for (i = 0; i < height ; i++)
     {
+        row(i, rgb.data());
+        unsigned char *line = bytes.data() + bmph.bfOffBits + i * bytesPerLine;
         for (j = 0; j < width; j++)
         {
-            ipos = (width * i + j);
-            line[3*j] = ClampColorComponent(rgb[ipos][2]);
-            line[3*j+1] =ClampColorComponent( rgb[ipos][1]);
-            line[3*j+2] = ClampColorComponent( rgb[ipos][0]);
+            line[3*j] = ClampColorComponent(rgb[j][2]);
+            line[3*j+1] =ClampColorComponent( rgb[j][1]);
+            line[3*j+2] = ClampColorComponent( rgb[j][0]);
         }
-        fwrite(line, bytesPerLine, 1, file);
     }
 
-    free(line);
-    fclose(file);
+    return bytes;
+}
 
-    return(1);
+int
+WriteFile(const char *filename, const std::vector<unsigned char> &bytes)
+{
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) return(0);
+    int success = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return fclose(file) == 0 && success;
+}
+
+int
+SaveBMP(const char *filename, int width, int height, const std::function<void(int, Vector3f *)> &row)
+{
+    return WriteFile(filename, EncodeBMP(width, height, row));
 }
 
 void Image::SaveImage(const char * filename)
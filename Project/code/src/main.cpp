@@ -12,6 +12,7 @@
 #include "light.hpp"
 
 #include "pt.hpp"
+#include "wavefront.hpp"
 
 #include <string>
 
@@ -22,8 +23,12 @@ int main(int argc, char *argv[]) {
         std::cout << "Argument " << argNum << " is: " << argv[argNum] << std::endl;
     }
 
-    if (argc != 6) {
-        cout << "Usage: ./build/PT <input scene file> <output bmp file> <rounds> <max_depth> <step>" << endl;
+    if (argc < 6) {
+        cout << "Usage: ./build/PT <input scene file> <output bmp file> <rounds> <max_depth> <step> [pt|wavefront]"
+                " [--max-spp <samples>] [--time <seconds>] [--threshold <relative error>]"
+                " [--rr-depth <bounces>] [--sampler sobol|independent] [--aovs variance,albedo,normal]" << endl;
+        cout << "With --max-spp or --time, rounds samples go to every pixel, then more to the noisy ones" << endl;
+        cout << "Paths end by russian roulette after rr-depth bounces (3, negative for never), max_depth is a cap" << endl;
         return 1;
     }
     string inputFile = argv[1];
@@ -31,6 +36,72 @@ int main(int argc, char *argv[]) {
     int rounds = atoi(argv[3]);
     int max_depth = atoi(argv[4]);
     int step = atoi(argv[5]);
+    int argi = 6;
+    string mode = argc > argi && strncmp(argv[argi], "--", 2) ? argv[argi++] : "pt";
+    if (mode != "pt" && mode != "wavefront") {
+        cout << "Unknown renderer " << mode << ", use pt or wavefront" << endl;
+        return 1;
+    }
+    // adaptive sampling, see PathTracing::renderAdaptive
+    int max_spp = 0;
+    double time_budget = 0;
+    float threshold = -1;
+    int rr_depth = 3;   // see PathTracing::survive
+    Sampler::Type sampler_type = Sampler::SOBOL;
+    int aovs = 0;       // saved next to the output, see Film
+    for (; argi < argc; argi++) {
+        string option = argv[argi];
+        if (argi + 1 >= argc) {
+            cout << "Missing value of " << option << endl;
+            return 1;
+        }
+        if (option == "--max-spp") {
+            max_spp = atoi(argv[++argi]);
+        } else if (option == "--time") {
+            time_budget = atof(argv[++argi]);
+        } else if (option == "--threshold") {
+            threshold = atof(argv[++argi]);
+        } else if (option == "--rr-depth") {
+            rr_depth = atoi(argv[++argi]);
+        } else if (option == "--sampler") {
+            string name = argv[++argi];
+            if (name != "sobol" && name != "independent") {
+                cout << "Unknown sampler " << name << ", use sobol or independent" << endl;
+                return 1;
+            }
+            sampler_type = name == "sobol" ? Sampler::SOBOL : Sampler::INDEPENDENT;
+        } else if (option == "--aovs") {
+            string names = string(argv[++argi]) + ",";
+            for (size_t start = 0, end; (end = names.find(',', start)) != string::npos; start = end + 1) {
+                string name = names.substr(start, end - start);
+                if (name == "variance") {
+                    aovs |= Film::AOV_VARIANCE;
+                } else if (name == "albedo") {
+                    aovs |= Film::AOV_ALBEDO;
+                } else if (name == "normal") {
+                    aovs |= Film::AOV_NORMAL;
+                } else {
+                    cout << "Unknown aov " << name << ", use variance, albedo or normal" << endl;
+                    return 1;
+                }
+            }
+        } else {
+            cout << "Unknown option " << option << endl;
+            return 1;
+        }
+    }
+    if (max_spp > 0 && max_spp < rounds) {
+        cout << "--max-spp must be at least rounds, every pixel takes rounds samples first" << endl;
+        return 1;
+    }
+    if (mode == "wavefront" && (max_spp > 0 || time_budget > 0)) {
+        cout << "Adaptive sampling is only in the pt renderer" << endl;
+        return 1;
+    }
+    if (mode == "wavefront" && aovs) {
+        cout << "AOVs are only in the pt renderer" << endl;
+        return 1;
+    }
 
     cout << "Hello! Computer Graphics!" << endl;
 
@@ -39,11 +110,25 @@ int main(int argc, char *argv[]) {
     srand((unsigned)time(NULL));
     
     SceneParser sceneParser(inputFile.c_str());
-    // Path Tracing
-    PathTracing pathTracing(&sceneParser, outputFile, rounds, max_depth, step);
-    pathTracing.render();
+    // Path Tracing, the wavefront one traces the paths of a tile in stages
+    PathTracing *pathTracing;
+    if (mode == "wavefront") {
+        pathTracing = new WavefrontPathTracing(&sceneParser, outputFile, rounds, max_depth, step);
+    } else {
+        pathTracing = new PathTracing(&sceneParser, outputFile, rounds, max_depth, step);
+        pathTracing->max_rounds = max_spp;
+        pathTracing->time_budget = time_budget;
+        if (threshold >= 0) {
+            pathTracing->threshold = threshold;
+        }
+        pathTracing->aovs = aovs;
+    }
+    pathTracing->rr_depth = rr_depth;
+    pathTracing->sampler_type = sampler_type;
+    pathTracing->render();
     // save the image
-    pathTracing.save();
+    pathTracing->save();
+    delete pathTracing;
     
     return 0;
 }
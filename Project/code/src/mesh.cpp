@@ -1,111 +1,301 @@
 #include "mesh.hpp"
-#include <fstream>
+#include "sampling.hpp"
+#include "obj_loader.hpp"
 #include <iostream>
 #include <algorithm>
 #include <cstdlib>
 #include <utility>
-#include <sstream>
 
 
 bool Mesh::intersect(const Ray &r, Hit &h, float tmin) {
-    // printf("mesh intersect\n");
-    // Optional: Change this brute force method into a faster one.
-    bool result = false;
-    for (int triId = 0; triId < (int) t.size(); ++triId) {
-        TriangleIndex& triIndex = t[triId];
-        // Triangle triangle(v[triIndex[0]],
-        //                   v[triIndex[1]], v[triIndex[2]], material);
-        // triangle.normal = n[triId];
-        Triangle triangle(v[triIndex[0]],
-            v[triIndex[1]], v[triIndex[2]], material);
-        if (!use_inter) {
-            triangle.normal = n[triId];
+    int triId;
+    return intersectNearest(r, h, tmin, triId);
+}
+
+bool Mesh::intersectNearest(const Ray &r, Hit &h, float tmin, int &triId) {
+    auto leaf = [&](int offset, int count) {
+        bool result = false;
+        for (int id = offset; id < offset + count; ++id) {
+            if (intersectTriangle(id, r, h, tmin)) {
+                triId = id;
+                result = true;
+            }
+        }
+        return result;
+    };
+    return width == 4 ? wide.intersect(r, h, tmin, leaf) : bvh.intersect(r, h, tmin, leaf);
+}
+
+int Mesh::intersectPacket(RayPacket &p, float tmin, int mask) {
+    return bvh.intersectPacket(p, tmin, mask, [&](int offset, int count, int lanes) {
+        int hits = 0;
+        Float4 tt, beta, gamma;
+        for (int triId = offset; triId < offset + count; ++triId) {
+            int tri_hits = hitTrianglePacket(triId, p, tmin, lanes, tt, beta, gamma);
+            for (int i = 0; i < PACKET_SIZE; i++) {
+                if (!(tri_hits >> i & 1)) continue;
+                setTriangleHit(triId, *p.hit[i], tt[i], beta[i], gamma[i]);
+                p.sync(i);
+            }
+            hits |= tri_hits;
+        }
+        return hits;
+    });
+}
+
+bool Mesh::occluded(const Ray &r, float tmin, float tmax) {
+    auto leaf = [&](int offset, int count) {
+        float tt, beta, gamma;
+        for (int triId = offset; triId < offset + count; ++triId) {
+            if (hitTriangle(triId, r, tmin, tmax, tt, beta, gamma) && tt < tmax) {
+                return true;
+            }
+        }
+        return false;
+    };
+    return width == 4 ? wide.occluded(r, tmin, tmax, leaf) : bvh.occluded(r, tmin, tmax, leaf);
+}
+
+bool Mesh::intersectTriangle(int triId, const Ray &r, Hit &h, float tmin) {
+    float tt, beta, gamma;
+    if (!hitTriangle(triId, r, tmin, h.getT(), tt, beta, gamma)) {
+        return false;
+    }
+    setTriangleHit(triId, h, tt, beta, gamma);
+    return true;
+}
+
+void Mesh::setTriangleHit(int triId, Hit &h, float tt, float beta, float gamma) {
+    if (use_inter) {
+        // barycentric weights equal the area weights used by Triangle
+        const TriangleIndex &normIndex = tn[triId];
+        Vector3f normal = (1 - beta - gamma) * vn[normIndex.x[0]] + beta * vn[normIndex.x[1]] + gamma * vn[normIndex.x[2]];
+        normal.normalize();
+        if (!uv.empty()) {
+            const TriangleIndex &triIndex = t[triId];
+            Vector2f texcoord = (1 - beta - gamma) * uv[triIndex.x[0]] + beta * uv[triIndex.x[1]] + gamma * uv[triIndex.x[2]];
+            h.set(tt, material, normal, texcoord.x(), texcoord.y());
         } else {
-            // printf("set normal\n");
-            // printf("triIndex[0] = %d\n", triIndex[0]);
-            triangle.setNormals(vn[triIndex[0]],
-                vn[triIndex[1]], vn[triIndex[2]]);
-            // printf("set normal\n");
+            h.set(tt, material, normal);
         }
-        result |= triangle.intersect(r, h, tmin);
+    } else {
+        h.set(tt, material, n[triId]);
     }
-    return result;
+    h.object = this;
 }
 
-Mesh::Mesh(const char *filename, Material *material, bool use_inter) : Object3D(material) {
+// same test as Triangle::intersect, but reads the vertices in place
+bool Mesh::hitTriangle(int triId, const Ray &r, float tmin, float tmax, float &tt, float &beta, float &gamma) const {
+    const TriangleIndex &triIndex = t[triId];
+    const Vector3f &v0 = v[triIndex.x[0]];
+    const Vector3f &v1 = v[triIndex.x[1]];
+    const Vector3f &v2 = v[triIndex.x[2]];
+    const Vector3f &dir = r.getDirection();
 
-    // Optional: Use tiny obj loader to replace this simple one.
-    std::ifstream f;
-    f.open(filename);
-    if (!f.is_open()) {
-        std::cout << "Cannot open " << filename << "\n";
-        return;
+    Vector3f e1 = v0 - v1;
+    Vector3f e2 = v0 - v2;
+    Vector3f s = v0 - r.getOrigin();
+    // det(a, b, c) = a . (b x c)
+    Vector3f e1_e2 = Vector3f::cross(e1, e2);
+    float under = Vector3f::dot(dir, e1_e2);
+    if (fabs(under) < 1e-6) {
+        return false;
+    }
+    float inv = 1 / under;
+    tt = Vector3f::dot(s, e1_e2) * inv;
+    if (tt < tmin || tt > tmax) {
+        return false;
     }
-    std::string line;
-    std::string vTok("v");
-    std::string fTok("f");
-    std::string texTok("vt");
+    beta = Vector3f::dot(dir, Vector3f::cross(s, e2)) * inv;
+    if (beta < 0) {
+        return false;
+    }
+    gamma = Vector3f::dot(dir, Vector3f::cross(e1, s)) * inv;
+    return gamma >= 0 && beta + gamma <= 1;
+}
 
-    this->use_inter = use_inter;
+// the operations of hitTriangle lane by lane, so the hits are the same
+int Mesh::hitTrianglePacket(int triId, const RayPacket &p, float tmin, int mask, Float4 &tt, Float4 &beta,
+                            Float4 &gamma) const {
+    const TriangleIndex &triIndex = t[triId];
+    const Vector3f &v0 = v[triIndex.x[0]];
+    const Vector3f &v1 = v[triIndex.x[1]];
+    const Vector3f &v2 = v[triIndex.x[2]];
 
-    // add normal
-    std::string vnTok("vn");
-    char bslash = '/', space = ' ';
-    std::string tok;
-    int texID;
-    while (true) {
-        std::getline(f, line);
-        if (f.eof()) {
-            break;
+    Vector3f e1 = v0 - v1;
+    Vector3f e2 = v0 - v2;
+    Vector3f e1_e2 = Vector3f::cross(e1, e2);
+    Float4 cx(e1_e2.x()), cy(e1_e2.y()), cz(e1_e2.z());
+    Float4 under = p.dx * cx + p.dy * cy + p.dz * cz;
+    // fabs(under) < 1e-6 compares in double, in float that is <= 1e-6f
+    mask &= ~movemask(abs(under) <= Float4(1e-6f));
+    if (!mask) {
+        return 0;
+    }
+    Float4 inv = Float4(1.0f) / under;
+    Float4 sx = Float4(v0.x()) - p.ox;
+    Float4 sy = Float4(v0.y()) - p.oy;
+    Float4 sz = Float4(v0.z()) - p.oz;
+    tt = (sx * cx + sy * cy + sz * cz) * inv;
+    mask &= ~movemask((tt < Float4(tmin)) | (tt > p.t));
+    if (!mask) {
+        return 0;
+    }
+    Float4 zero(0.0f);
+    Float4 e2x(e2.x()), e2y(e2.y()), e2z(e2.z());
+    beta = (p.dx * (sy * e2z - sz * e2y) + p.dy * (sz * e2x - sx * e2z) + p.dz * (sx * e2y - sy * e2x)) * inv;
+    mask &= ~movemask(beta < zero);
+    if (!mask) {
+        return 0;
+    }
+    Float4 e1x(e1.x()), e1y(e1.y()), e1z(e1.z());
+    gamma = (p.dx * (e1y * sz - e1z * sy) + p.dy * (e1z * sx - e1x * sz) + p.dz * (e1x * sy - e1y * sx)) * inv;
+    return mask & movemask((gamma >= zero) & (beta + gamma <= Float4(1.0f)));
+}
+
+bool Mesh::sampleLight(const Vector3f &p, const Vector2f &u, Vector3f &dir, float &dist, float &pdf) {
+    if (area_cdf.empty() || area_cdf.back() <= 0) {
+        return false;
+    }
+    // u.x picks the triangle by area, then where it fell in the triangle is the first coordinate in it
+    float total = area_cdf.back();
+    float pick = u.x() * total;
+    int triId = std::upper_bound(area_cdf.begin(), area_cdf.end(), pick) - area_cdf.begin();
+    triId = std::min(triId, (int) t.size() - 1);
+    float start = triId > 0 ? area_cdf[triId - 1] : 0;
+    float u1 = fmin((pick - start) / (area_cdf[triId] - start), 0.99999994f);
+    const TriangleIndex &triIndex = t[triId];
+    const Vector3f &v0 = v[triIndex.x[0]];
+    const Vector3f &v1 = v[triIndex.x[1]];
+    const Vector3f &v2 = v[triIndex.x[2]];
+    float b1, b2;
+    uniform_triangle(u1, u.y(), b1, b2);
+    Vector3f pq = (1 - b1 - b2) * v0 + b1 * v1 + b2 * v2 - p;
+    dist = pq.length();
+    if (dist < 1e-6) {
+        return false;
+    }
+    dir = pq / dist;
+    pdf = area_to_solid_angle(1 / total, dist, Vector3f::dot(faceNormal(triId), dir));
+    return pdf > 0;
+}
+
+float Mesh::lightPdf(const Ray &r, float &tt) {
+    if (area_cdf.empty() || area_cdf.back() <= 0) {
+        return 0;
+    }
+    // the density sampleLight picks the point with, so by the face and not the shading normal
+    Hit hit;
+    int triId;
+    if (!intersectNearest(r, hit, 1e-3, triId)) {
+        return 0;
+    }
+    tt = hit.getT();
+    return area_to_solid_angle(1 / area_cdf.back(), tt, Vector3f::dot(faceNormal(triId), r.getDirection()));
+}
+
+Vector3f Mesh::faceNormal(int triId) const {
+    const TriangleIndex &triIndex = t[triId];
+    const Vector3f &v0 = v[triIndex.x[0]];
+    return Vector3f::cross(v[triIndex.x[1]] - v0, v[triIndex.x[2]] - v0).normalized();
+}
+
+void Mesh::computeAreas() {
+    area_cdf.resize(t.size());
+    float sum = 0;
+    for (int triId = 0; triId < (int) t.size(); ++triId) {
+        const TriangleIndex &triIndex = t[triId];
+        sum += 0.5f * Vector3f::cross(v[triIndex.x[1]] - v[triIndex.x[0]], v[triIndex.x[2]] - v[triIndex.x[0]]).length();
+        area_cdf[triId] = sum;
+    }
+}
+
+void Mesh::buildBVH(const BVHConfig &config) {
+    std::vector<BVHPrimitive> prims(t.size());
+    for (int triId = 0; triId < (int) t.size(); ++triId) {
+        BVHPrimitive &prim = prims[triId];
+        prim.index = triId;
+        prim.box = AABB::empty();
+        for (int k = 0; k < 3; k++) {
+            prim.box.expand(v[t[triId][k]]);
+        }
+        prim.centroid = prim.box.centroid();
+    }
+    bvh.build(prims, config);
+    width = config.width;
+    if (width == 4) {
+        wide.build(bvh);
+    }
+
+    // put the triangles in leaf order
+    std::vector<TriangleIndex> sorted_t(t.size());
+    std::vector<TriangleIndex> sorted_tn(tn.size());
+    std::vector<Vector3f> sorted_n(n.size());
+    for (int i = 0; i < (int) prims.size(); ++i) {
+        sorted_t[i] = t[prims[i].index];
+        if (!tn.empty()) {
+            sorted_tn[i] = tn[prims[i].index];
         }
-        if (line.size() < 3) {
-            continue;
+        if (!n.empty()) {
+            sorted_n[i] = n[prims[i].index];
         }
-        if (line.at(0) == '#') {
-            continue;
+    }
+    t.swap(sorted_t);
+    tn.swap(sorted_tn);
+    n.swap(sorted_n);
+}
+
+Mesh::Mesh(const char *filename, Material *material, bool use_inter, const BVHConfig &config) : Object3D(material) {
+    this->use_inter = use_inter;
+
+    ObjData data;
+    if (!load_obj(filename, data)) {
+        std::cout << "Cannot open " << filename << "\n";
+        return;
+    }
+    v.swap(data.v);
+    vn.swap(data.vn);
+    t.resize(data.faces.size() / 3);
+    for (int triId = 0; triId < (int) t.size(); ++triId) {
+        for (int k = 0; k < 3; k++) {
+            t[triId][k] = data.faces[3 * triId + k];
         }
-        std::stringstream ss(line);
-        ss >> tok;
-        if (tok == vTok) {
-            Vector3f vec;
-            ss >> vec[0] >> vec[1] >> vec[2];
-            v.push_back(vec);
-        } else if (tok == fTok) {
-            if (line.find(bslash) != std::string::npos) {
-                std::replace(line.begin(), line.end(), bslash, space);
-                std::stringstream facess(line);
-                TriangleIndex trig;
-                facess >> tok;
-                for (int ii = 0; ii < 3; ii++) {
-                    facess >> trig[ii] >> texID;
-                    trig[ii]--;
-                }
-                t.push_back(trig);
-            } else {
-                TriangleIndex trig;
-                for (int ii = 0; ii < 3; ii++) {
-                    ss >> trig[ii];
-                    trig[ii]--;
-                }
-                t.push_back(trig);
+    }
+    if (use_inter) {
+        // a corner without a normal index uses the normal with the index of its vertex
+        tn.resize(t.size());
+        bool valid = true;
+        for (int triId = 0; triId < (int) t.size(); ++triId) {
+            for (int k = 0; k < 3; k++) {
+                int normId = data.face_normals[3 * triId + k];
+                tn[triId][k] = normId >= 0 ? normId : t[triId][k];
+                valid &= tn[triId][k] < (int) vn.size();
             }
-        } else if (tok == texTok) {
-            Vector2f texcoord;
-            ss >> texcoord[0];
-            ss >> texcoord[1];
-        } else if (tok == vnTok) {
-            Vector3f normal;
-            ss >> normal[0];
-            ss >> normal[1];
-            ss >> normal[2];
-            vn.push_back(normal);
+        }
+        if (!valid) {
+            std::cout << "Missing vertex normals in " << filename << ", using face normals\n";
+            this->use_inter = false;
+            tn.clear();
         }
     }
-    if (!use_inter) {
+    if (!this->use_inter) {
         computeNormal();
     }
+    buildBVH(config);
+    computeAreas();
+}
 
-    f.close();
+Mesh::Mesh(std::vector<Vector3f> vertices, std::vector<Vector3f> normals, std::vector<Vector2f> uvs,
+           std::vector<TriangleIndex> triangles, Material *material, const BVHConfig &config)
+    : Object3D(material) {
+    use_inter = true;
+    v.swap(vertices);
+    vn.swap(normals);
+    uv.swap(uvs);
+    t.swap(triangles);
+    tn = t;
+    buildBVH(config);
+    computeAreas();
 }
 
 void Mesh::computeNormal() {
@@ -0,0 +1,386 @@
+#include "obj_loader.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <string>
+#include <algorithm>
+#include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// a read only mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const char *filename) {
+        fd = open(filename, O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) != 0) return;
+        size = st.st_size;
+        mtime = st.st_mtime;
+        if (size == 0) {
+            ok = true;
+            return;
+        }
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) return;
+        madvise(p, size, MADV_SEQUENTIAL);
+        data = (const char *) p;
+        ok = true;
+    }
+
+    ~MappedFile() {
+        if (data) munmap((void *) data, size);
+        if (fd >= 0) close(fd);
+    }
+
+    bool ok = false;
+    const char *data = nullptr;
+    size_t size = 0;
+    int64_t mtime = 0;
+
+private:
+    int fd = -1;
+};
+
+/* ---------------- text parsing ---------------- */
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline void skip_blanks(const char *&p, const char *end) {
+    while (p < end && is_blank(*p)) p++;
+}
+
+static inline void skip_line(const char *&p, const char *end) {
+    const char *nl = (const char *) memchr(p, '\n', end - p);
+    p = nl ? nl + 1 : end;
+}
+
+static inline bool parse_int(const char *&p, const char *end, int &out) {
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') return false;
+    long long value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p - '0');
+        if (value > INT_MAX) return false;
+        p++;
+    }
+    out = neg ? -(int) value : (int) value;
+    return true;
+}
+
+// decimal float without going through the locale, like from_chars.
+// short mantissas with small exponents are exact in float, so one multiply or divide rounds correctly,
+// anything longer falls back to strtof and gives the same bits as before
+static inline bool parse_float(const char *&p, const char *end, float &out) {
+    static const float pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+    skip_blanks(p, end);
+    const char *start = p;
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        neg = *p == '-';
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+        } else {
+            exponent++;
+        }
+        any = true;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) digits++;
+                exponent--;
+            }
+            any = true;
+            p++;
+        }
+    }
+    if (!any) return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int e;
+        if (parse_int(q, end, e)) {
+            exponent += e;
+            p = q;
+        }
+    }
+    if (mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10) {
+        float value = (float) mantissa;
+        value = exponent >= 0 ? value * pow10[exponent] : value / pow10[-exponent];
+        out = neg ? -value : value;
+        return true;
+    }
+    char buffer[64];
+    size_t len = std::min<size_t>(p - start, sizeof(buffer) - 1);
+    memcpy(buffer, start, len);
+    buffer[len] = 0;
+    out = strtof(buffer, nullptr);
+    return true;
+}
+
+// what one chunk of the file holds. indices are 0 based, a negative index in the file
+// refers to the vertices before it, those are kept relative to the chunk and listed in fix_v / fix_vn
+struct ObjChunk {
+    const char *begin, *end;
+    std::vector<Vector3f> v, vn;
+    std::vector<int> faces, face_normals;
+    std::vector<int> fix_v, fix_vn;     // positions in faces / face_normals to offset by the earlier chunks
+    int bad_lines = 0;
+};
+
+// a corner without a normal index
+static const int NO_NORMAL = INT_MIN;
+
+static void parse_chunk(ObjChunk &chunk) {
+    const char *p = chunk.begin, *end = chunk.end;
+    // corners of the current face: vertex, normal, and whether each is relative
+    std::vector<int> cv, cn;
+    std::vector<char> cv_rel, cn_rel;
+    while (p < end) {
+        skip_blanks(p, end);
+        if (p >= end) break;
+        if (*p == 'v' && p + 1 < end && (is_blank(p[1]) || p[1] == 'n')) {
+            bool normal = p[1] == 'n';
+            p += normal ? 2 : 1;
+            Vector3f vec;
+            if (parse_float(p, end, vec[0]) && parse_float(p, end, vec[1]) && parse_float(p, end, vec[2])) {
+                (normal ? chunk.vn : chunk.v).push_back(vec);
+            } else {
+                chunk.bad_lines++;
+            }
+        } else if (*p == 'f' && p + 1 < end && is_blank(p[1])) {
+            p++;
+            cv.clear(); cn.clear(); cv_rel.clear(); cn_rel.clear();
+            bool ok = true;
+            while (true) {
+                skip_blanks(p, end);
+                if (p >= end || *p == '\n' || *p == '#') break;
+                int vi, ti, ni = 0;
+                if (!parse_int(p, end, vi) || vi == 0) { ok = false; break; }
+                bool has_normal = false;
+                if (p < end && *p == '/') {
+                    p++;
+                    if (p < end && *p != '/') {
+                        // texture coordinates are not used by the mesh
+                        if (!parse_int(p, end, ti)) { ok = false; break; }
+                    }
+                    if (p < end && *p == '/') {
+                        p++;
+                        if (!parse_int(p, end, ni) || ni == 0) { ok = false; break; }
+                        has_normal = true;
+                    }
+                }
+                cv.push_back(vi > 0 ? vi - 1 : (int) chunk.v.size() + vi);
+                cv_rel.push_back(vi < 0);
+                if (has_normal) {
+                    cn.push_back(ni > 0 ? ni - 1 : (int) chunk.vn.size() + ni);
+                    cn_rel.push_back(ni < 0);
+                } else {
+                    cn.push_back(NO_NORMAL);
+                    cn_rel.push_back(false);
+                }
+            }
+            if (!ok || cv.size() < 3) {
+                chunk.bad_lines++;
+            } else {
+                // fan around the first corner
+                for (size_t k = 1; k + 1 < cv.size(); k++) {
+                    size_t corners[3] = {0, k, k + 1};
+                    for (size_t c : corners) {
+                        if (cv_rel[c]) chunk.fix_v.push_back(chunk.faces.size());
+                        if (cn_rel[c]) chunk.fix_vn.push_back(chunk.face_normals.size());
+                        chunk.faces.push_back(cv[c]);
+                        chunk.face_normals.push_back(cn[c]);
+                    }
+                }
+            }
+        }
+        // vt, comments, groups, materials and the rest of the line
+        skip_line(p, end);
+    }
+}
+
+static bool parse_obj(const MappedFile &file, ObjData &data) {
+    const char *begin = file.data, *end = file.data + file.size;
+    // about a megabyte per chunk, a few chunks per thread to balance them
+    int threads = omp_get_max_threads();
+    int num_chunks = (int) std::max<size_t>(1, std::min<size_t>(file.size >> 20, 4 * threads));
+    std::vector<ObjChunk> chunks(num_chunks);
+    const char *p = begin;
+    for (int k = 0; k < num_chunks; k++) {
+        chunks[k].begin = p;
+        const char *q = k + 1 == num_chunks ? end : begin + file.size * (k + 1) / num_chunks;
+        if (q < p) q = p;
+        if (q < end) skip_line(q, end);
+        chunks[k].end = q;
+        p = q;
+    }
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < num_chunks; k++) {
+        parse_chunk(chunks[k]);
+    }
+
+    // offsets of each chunk in the merged arrays
+    std::vector<size_t> v_off(num_chunks + 1, 0), vn_off(num_chunks + 1, 0), f_off(num_chunks + 1, 0);
+    int bad_lines = 0;
+    for (int k = 0; k < num_chunks; k++) {
+        v_off[k + 1] = v_off[k] + chunks[k].v.size();
+        vn_off[k + 1] = vn_off[k] + chunks[k].vn.size();
+        f_off[k + 1] = f_off[k] + chunks[k].faces.size();
+        bad_lines += chunks[k].bad_lines;
+    }
+    data.v.resize(v_off[num_chunks]);
+    data.vn.resize(vn_off[num_chunks]);
+    data.faces.resize(f_off[num_chunks]);
+    data.face_normals.resize(f_off[num_chunks]);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < num_chunks; k++) {
+        ObjChunk &chunk = chunks[k];
+        std::copy(chunk.v.begin(), chunk.v.end(), data.v.begin() + v_off[k]);
+        std::copy(chunk.vn.begin(), chunk.vn.end(), data.vn.begin() + vn_off[k]);
+        for (int i : chunk.fix_v) chunk.faces[i] += v_off[k];
+        for (int i : chunk.fix_vn) chunk.face_normals[i] += vn_off[k];
+        std::copy(chunk.faces.begin(), chunk.faces.end(), data.faces.begin() + f_off[k]);
+        std::copy(chunk.face_normals.begin(), chunk.face_normals.end(), data.face_normals.begin() + f_off[k]);
+        std::vector<Vector3f>().swap(chunk.v);
+        std::vector<Vector3f>().swap(chunk.vn);
+    }
+
+    // drop the triangles that point outside the vertices
+    int nv = data.v.size(), nvn = data.vn.size();
+    size_t kept = 0;
+    for (size_t tri = 0; tri < data.faces.size(); tri += 3) {
+        bool ok = true;
+        for (int c = 0; c < 3; c++) {
+            int vi = data.faces[tri + c], ni = data.face_normals[tri + c];
+            ok &= vi >= 0 && vi < nv && (ni == NO_NORMAL || (ni >= 0 && ni < nvn));
+        }
+        if (ok) {
+            for (int c = 0; c < 3; c++) {
+                int ni = data.face_normals[tri + c];
+                data.faces[kept + c] = data.faces[tri + c];
+                data.face_normals[kept + c] = ni == NO_NORMAL ? -1 : ni;
+            }
+            kept += 3;
+        } else {
+            bad_lines++;
+        }
+    }
+    data.faces.resize(kept);
+    data.face_normals.resize(kept);
+    if (bad_lines > 0) {
+        printf("OBJ: skipped %d malformed lines or faces\n", bad_lines);
+    }
+    return true;
+}
+
+/* ---------------- binary cache ---------------- */
+
+struct MeshBinHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t vector_size;   // floats are stored 3 per vector, this only guards the layout
+    int64_t source_size;
+    int64_t source_mtime;
+    uint64_t num_v, num_vn, num_indices;
+};
+
+static const char MESHBIN_MAGIC[8] = {'M', 'E', 'S', 'H', 'B', 'I', 'N', 0};
+static const uint32_t MESHBIN_VERSION = 1;
+
+static size_t meshbin_size(const MeshBinHeader &h) {
+    return sizeof(MeshBinHeader) + 3 * sizeof(float) * (h.num_v + h.num_vn) + 2 * sizeof(int) * h.num_indices;
+}
+
+static bool load_meshbin(const std::string &path, const MappedFile &source, ObjData &data) {
+    MappedFile file(path.c_str());
+    if (!file.ok || file.size < sizeof(MeshBinHeader)) return false;
+    MeshBinHeader h;
+    memcpy(&h, file.data, sizeof(h));
+    if (memcmp(h.magic, MESHBIN_MAGIC, 8) != 0 || h.version != MESHBIN_VERSION || h.vector_size != 3 ||
+        h.source_size != (int64_t) source.size || h.source_mtime != source.mtime || file.size != meshbin_size(h)) {
+        return false;
+    }
+    const float *f = (const float *) (file.data + sizeof(MeshBinHeader));
+    data.v.resize(h.num_v);
+    for (size_t i = 0; i < h.num_v; i++, f += 3) data.v[i] = Vector3f(f[0], f[1], f[2]);
+    data.vn.resize(h.num_vn);
+    for (size_t i = 0; i < h.num_vn; i++, f += 3) data.vn[i] = Vector3f(f[0], f[1], f[2]);
+    const int *idx = (const int *) f;
+    data.faces.assign(idx, idx + h.num_indices);
+    data.face_normals.assign(idx + h.num_indices, idx + 2 * h.num_indices);
+    return true;
+}
+
+// written to a temporary file and renamed, so a reader never sees half of it
+static void save_meshbin(const std::string &path, const MappedFile &source, const ObjData &data) {
+    MeshBinHeader h;
+    memcpy(h.magic, MESHBIN_MAGIC, 8);
+    h.version = MESHBIN_VERSION;
+    h.vector_size = 3;
+    h.source_size = source.size;
+    h.source_mtime = source.mtime;
+    h.num_v = data.v.size();
+    h.num_vn = data.vn.size();
+    h.num_indices = data.faces.size();
+
+    std::vector<char> buffer(meshbin_size(h));
+    memcpy(buffer.data(), &h, sizeof(h));
+    float *f = (float *) (buffer.data() + sizeof(h));
+    for (const Vector3f &p : data.v) { *f++ = p.x(); *f++ = p.y(); *f++ = p.z(); }
+    for (const Vector3f &p : data.vn) { *f++ = p.x(); *f++ = p.y(); *f++ = p.z(); }
+    int *idx = (int *) f;
+    memcpy(idx, data.faces.data(), data.faces.size() * sizeof(int));
+    memcpy(idx + data.faces.size(), data.face_normals.data(), data.face_normals.size() * sizeof(int));
+
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;     // e.g. a read only directory, the cache is optional
+    bool ok = write(fd, buffer.data(), buffer.size()) == (ssize_t) buffer.size();
+    ok &= close(fd) == 0;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+    }
+}
+
+bool load_obj(const char *filename, ObjData &data, bool use_cache) {
+    MappedFile file(filename);
+    if (!file.ok) {
+        return false;
+    }
+    std::string cache = std::string(filename) + ".meshbin";
+    if (use_cache && load_meshbin(cache, file, data)) {
+        return true;
+    }
+    if (!parse_obj(file, data)) {
+        return false;
+    }
+    if (use_cache) {
+        save_meshbin(cache, file, data);
+    }
+    return true;
+}
@@ -9,6 +9,7 @@
 #include "material.hpp"
 #include "object3d.hpp"
 #include "group.hpp"
+#include "bvh.hpp"
 #include "mesh.hpp"
 #include "sphere.hpp"
 #include "moving_sphere.hpp"
@@ -33,6 +34,8 @@ SceneParser::SceneParser(const char *filename) {
     num_materials = 0;
     materials = nullptr;
     current_material = nullptr;
+    current_bvh_config = nullptr;
+    local_depth = 0;
 
     // parse the file
     assert(filename != nullptr);
@@ -351,7 +354,8 @@ Group *SceneParser::parseGroup() {
     //
     // the material index sets the material of all objects which follow,
     // until the next material index (scoping for the materials is very
-    // simple, and essentially ignores any tree hierarchy)
+    // simple, and essentially ignores any tree hierarchy). a BVH block
+    // likewise sets the bvh of the meshes which follow
     //
     char token[MAX_PARSER_TOKEN_LENGTH];
     getToken(token);
@@ -373,6 +377,11 @@ Group *SceneParser::parseGroup() {
             int index = readInt();
             assert (index >= 0 && index <= getNumMaterials());
             current_material = getMaterial(index);
+        } else if (!strcmp(token, "BVH")) {
+            // the bvh is built when the last object is added, so this must come before it
+            answer->use_bvh = true;
+            answer->bvh_config = parseBVH();
+            current_bvh_config = &answer->bvh_config;
         } else {
             Object3D *object = parseObject(token);
             assert (object != nullptr);
@@ -388,6 +397,51 @@ Group *SceneParser::parseGroup() {
     return answer;
 }
 
+BVHConfig SceneParser::parseBVH() {
+    // BVH { split sah leafSize 4 bins 16 traversalCost 1 intersectCost 1 width 4 }
+    // every field is optional
+    char token[MAX_PARSER_TOKEN_LENGTH];
+    BVHConfig config;
+    getToken(token);
+    assert (!strcmp(token, "{"));
+    while (true) {
+        getToken(token);
+        if (!strcmp(token, "}")) {
+            break;
+        } else if (!strcmp(token, "split")) {
+            getToken(token);
+            if (!strcmp(token, "sah")) {
+                config.split = BVHConfig::SAH;
+            } else if (!strcmp(token, "median")) {
+                config.split = BVHConfig::MEDIAN;
+            } else {
+                printf("Unknown split method in parseBVH: '%s'\n", token);
+                exit(0);
+            }
+        } else if (!strcmp(token, "leafSize")) {
+            config.leaf_size = readInt();
+            assert (config.leaf_size >= 1);
+        } else if (!strcmp(token, "bins")) {
+            config.bins = readInt();
+            assert (config.bins >= 2);
+        } else if (!strcmp(token, "traversalCost")) {
+            config.traversal_cost = readFloat();
+        } else if (!strcmp(token, "intersectCost")) {
+            config.intersect_cost = readFloat();
+        } else if (!strcmp(token, "width")) {
+            config.width = readInt();
+            if (config.width != 2 && config.width != 4) {
+                printf("BVH width must be 2 or 4 in parseBVH, got %d\n", config.width);
+                exit(0);
+            }
+        } else {
+            printf("Unknown token in parseBVH: '%s'\n", token);
+            exit(0);
+        }
+    }
+    return config;
+}
+
 // ====================================================================
 // ====================================================================
 
@@ -404,7 +458,9 @@ Sphere *SceneParser::parseSphere() {
     getToken(token);
     assert (!strcmp(token, "}"));
     assert (current_material != nullptr);
-    return new Sphere(center, radius, current_material);
+    auto *answer = new Sphere(center, radius, current_material);
+    addEmitter(answer);
+    return answer;
 }
 
 MovingSphere *SceneParser::parseMovingSphere() {
@@ -465,7 +521,9 @@ Triangle *SceneParser::parseTriangle() {
     getToken(token);
     assert (!strcmp(token, "}"));
     assert (current_material != nullptr);
-    return new Triangle(v0, v1, v2, current_material);
+    auto *answer = new Triangle(v0, v1, v2, current_material);
+    addEmitter(answer);
+    return answer;
 }
 
 Mesh *SceneParser::parseTriangleMesh() {
@@ -486,7 +544,9 @@ Mesh *SceneParser::parseTriangleMesh() {
     assert (!strcmp(token, "}"));
     const char *ext = &filename[strlen(filename) - 4];
     assert(!strcmp(ext, ".obj"));
-    Mesh *answer = new Mesh(filename, current_material, use_inter);
+    BVHConfig config = current_bvh_config ? *current_bvh_config : BVHConfig();
+    Mesh *answer = new Mesh(filename, current_material, use_inter, config);
+    addEmitter(answer);
 
     return answer;
 }
@@ -543,7 +603,9 @@ Transform *SceneParser::parseTransform() {
         } else {
             // otherwise this must be an object,
             // and there are no more transformations
+            local_depth++;
             object = parseObject(token);
+            local_depth--;
             break;
         }
         getToken(token);
@@ -604,7 +666,7 @@ Curve *SceneParser::parseBsplineCurve() {
     return answer;
 }
 
-RevSurface *SceneParser::parseRevSurface() {
+Object3D *SceneParser::parseRevSurface() {
     char token[MAX_PARSER_TOKEN_LENGTH];
     getToken(token);
     assert (!strcmp(token, "{"));
@@ -620,9 +682,26 @@ RevSurface *SceneParser::parseRevSurface() {
         printf("Unknown profile type in parseRevSurface: '%s'\n", token);
         exit(0);
     }
+    // tessellate <tolerance> traces a triangle mesh within tolerance of the surface instead
+    float tolerance = 0;
     getToken(token);
+    if (!strcmp(token, "tessellate")) {
+        tolerance = readFloat();
+        if (tolerance <= 0) {
+            printf("The tessellation tolerance of a RevSurface must be positive!\n");
+            exit(0);
+        }
+        getToken(token);
+    }
     assert (!strcmp(token, "}"));
     auto *answer = new RevSurface(profile, current_material);
+    if (tolerance > 0) {
+        BVHConfig config = current_bvh_config ? *current_bvh_config : BVHConfig();
+        Mesh *mesh = answer->tessellate(tolerance, config);
+        delete answer;
+        addEmitter(mesh);
+        return mesh;
+    }
     return answer;
 }
 
@@ -634,7 +713,9 @@ Box* SceneParser::parseBox() {
     Vector3f max_corner = readVector3f();
     getToken(token);
     assert (!strcmp(token, "}"));
-    return new Box(min_corner, max_corner, current_material);
+    auto *answer = new Box(min_corner, max_corner, current_material);
+    addEmitter(answer);
+    return answer;
 }
 
 Media* SceneParser::parseMedia() {
@@ -647,12 +728,22 @@ Media* SceneParser::parseMedia() {
     float density = readFloat();
     Object3D* object = nullptr;
     getToken(token);
+    local_depth++;
     object = parseObject(token);
+    local_depth--;
     getToken(token);
     assert (!strcmp(token, "}"));
     return new Media(object, density);
 }
 
+void SceneParser::addEmitter(Object3D *object) {
+    // only objects placed directly in the world are sampled, the others are still found by the paths
+    Material *material = object->getMaterial();
+    if (local_depth == 0 && material != nullptr && material->selfColor.squaredLength() > 0) {
+        emitters.push_back(object);
+    }
+}
+
 // ====================================================================
 // ====================================================================
 